@@ -1,121 +1,340 @@
 ﻿#include "ClusteredLinearRegression.h"
 #include "MLUtils.h"
+#include "ThreadPool.h"
+#include "NormalEquation.h"
+#include "ModelFile.h"
+#include <cstring>
 
 using namespace std;
 
-ClusteredLinearRegression::ClusteredLinearRegression(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, int minClusterSize) {
-	int N = X.rows;
-
-	vector<cv::Mat_<float> > clusterX, clusterY;
-	vector<cv::Mat_<float> > floatCentroids;
-	{
-		cv::Mat floatX, floatY;
-		X.convertTo(floatX, CV_32F);
-		Y.convertTo(floatY, CV_32F);
-		
-		cv::Mat_<float> centroid;
-		X.convertTo(centroid, CV_32F);
-		cv::reduce(centroid, centroid, 0, CV_REDUCE_AVG);
-		partition(floatX, floatY, centroid, minClusterSize, clusterX, clusterY, floatCentroids);
+ClusteredLinearRegression::ClusteredLinearRegression() {
+}
+
+/**
+ * データXをk-meansクラスタリングで階層的に分割し、各クラスタで線形回帰を学習する。
+ * 分割の2つの枝、および各クラスタの線形回帰は、スレッドプールで並列に計算する。
+ *
+ * @param X					データX
+ * @param Y					データY
+ * @param minClusterSize	クラスタの最小サイズ
+ * @param kmeansAttempts	各分割でk-meansを試す回数
+ * @param kmeansIterations	k-meansの最大反復回数
+ * @param seed				k-meansの初期値に使う乱数のシード
+ */
+ClusteredLinearRegression::ClusteredLinearRegression(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, int minClusterSize, int kmeansAttempts, int kmeansIterations, unsigned long long seed) {
+	// k-meansはfloatのデータしか扱えないので、1度だけfloatに変換する。
+	// 分割は、この行列とindicesの行をその場で入れ替えて行う。
+	cv::Mat_<float> floatX;
+	X.convertTo(floatX, CV_32F);
+	vector<int> indices(X.rows);
+	for (int i = 0; i < X.rows; ++i) {
+		indices[i] = i;
 	}
 
-	clusterCentroids.resize(clusterX.size());
-	W.resize(clusterX.size());
+	cv::Mat_<double> centroid;
+	cv::reduce(X, centroid, 0, CV_REDUCE_AVG);
+
+	vector<Cluster> clusters;
+	partition(floatX, indices, 0, X.rows, centroid, minClusterSize, kmeansAttempts, kmeansIterations, seed, clusters);
+
+	clusterCentroids.create(clusters.size(), X.cols);
+	W.resize(clusters.size());
+
+	// 各クラスタの線形回帰を、並列に解く
+	ThreadPool::instance().parallelFor(0, clusters.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			int n = clusters[i].end - clusters[i].begin;
+			cv::Mat_<double> clusterX(n, X.cols);
+			cv::Mat_<double> clusterY(n, Y.cols);
+			for (int r = 0; r < n; ++r) {
+				int index = indices[clusters[i].begin + r];
+				memcpy(clusterX[r], X[index], sizeof(double) * X.cols);
+				memcpy(clusterY[r], Y[index], sizeof(double) * Y.cols);
+			}
+
+			NormalEquation eq;
+			eq.add(clusterX, clusterY, 1);
+			eq.solve(W[i], cv::DECOMP_CHOLESKY);
+
+			clusters[i].centroid.copyTo(clusterCentroids.row(i));
+		}
+	});
+
+	buildIndex();
+}
+
+cv::Mat_<double> ClusteredLinearRegression::predict(const cv::Mat_<double>& x) const {
+	cv::Mat_<double> y(1, W[0].cols);
+	predictRow(x[0], y[0]);
+	return y;
+}
+
+/**
+ * Xの各行について、まとめて予測する。
+ * 行を区間に分けて、スレッドプールで並列に計算する。
+ *
+ * @param X				データX (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				予測値 (N x K)
+ */
+cv::Mat_<double> ClusteredLinearRegression::predictBatch(const cv::Mat_<double>& X, int numThreads) const {
+	cv::Mat_<double> Y(X.rows, W[0].cols);
+
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			predictRow(X[r], Y[r]);
+		}
+	}, numThreads);
+
+	return Y;
+}
+
+/**
+ * Xの各行について、単精度でまとめて予測する。
+ * 学習はdoubleで行い、推論時だけfloatの重心と係数を使って、メモリ帯域を半分にする。
+ *
+ * @param X				データX (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				予測値 (N x K)
+ */
+cv::Mat_<float> ClusteredLinearRegression::predictBatchFloat(const cv::Mat_<float>& X, int numThreads) const {
+	cv::Mat_<float> Y(X.rows, floatW.cols);
+
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			predictRow(X[r], Y[r]);
+		}
+	}, numThreads);
+
+	return Y;
+}
+
+/**
+ * 単精度で推論した場合の誤差を、倍精度の予測値に対するRMSEで返却する。
+ * クラスタの境界付近では、丸め誤差で別のクラスタが選ばれることがあるので、検証用のデータで確認すること。
+ *
+ * @param X				検証用のデータX (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				RMSE (ml::rmse、averageColumns = false)
+ */
+double ClusteredLinearRegression::floatRmse(const cv::Mat_<double>& X, int numThreads) const {
+	cv::Mat_<float> floatX;
+	X.convertTo(floatX, CV_32F);
+
+	cv::Mat_<double> floatY;
+	predictBatchFloat(floatX, numThreads).convertTo(floatY, CV_64F);
 
-	for (int i = 0; i < clusterX.size(); ++i) {
-		floatCentroids[i].convertTo(clusterCentroids[i], CV_64F);
+	return ml::rmse(predictBatch(X, numThreads), floatY, false);
+}
 
-		cv::Mat_<double> X2;
-		clusterX[i].convertTo(X2, CV_64F);
-		ml::addBias(X2);
-		cv::Mat_<double> Y2;
-		clusterY[i].convertTo(Y2, CV_64F);
+/**
+ * クラスタの重心をセクションcentroids、各クラスタの係数を縦に連結してセクションWとして追加する。
+ * 正規化の平均・標準偏差なども同じファイルに保存したい場合は、このあとfile.addで追加する。
+ *
+ * @param file		モデルファイル
+ */
+void ClusteredLinearRegression::write(ModelFile& file) const {
+	int rows = W.empty() ? 0 : W[0].rows;
+	int cols = W.empty() ? 0 : W[0].cols;
 
-		W[i] = X2.inv(cv::DECOMP_SVD) * Y2;
+	cv::Mat_<double> allW(W.size() * rows, cols);
+	for (int i = 0; i < W.size(); ++i) {
+		W[i].copyTo(allW.rowRange(i * rows, (i + 1) * rows));
 	}
+
+	file.add("centroids", clusterCentroids);
+	file.add("W", allW);
 }
 
-cv::Mat_<double> ClusteredLinearRegression::predict(const cv::Mat_<double>& x) {
+/**
+ * モデルファイルから重心と各クラスタの係数を読み込み、重心の探索用indexを作り直す。
+ * 各クラスタの係数は、1つの連続領域を行で分けて参照する。
+ *
+ * @param file		モデルファイル
+ * @return			セクションがない、またはサイズが合わなければfalse
+ */
+bool ClusteredLinearRegression::read(const ModelFile& file) {
+	cv::Mat_<double> centroids, allW;
+	if (!file.get("centroids", centroids) || !file.get("W", allW)) return false;
+
+	int numClusters = centroids.rows;
+	if (numClusters == 0 || allW.rows != numClusters * (centroids.cols + 1)) return false;
+
+	clusterCentroids = centroids.clone();
+	allW = allW.clone();
+
+	int rows = centroids.cols + 1;
+	W.resize(numClusters);
+	for (int i = 0; i < numClusters; ++i) {
+		W[i] = allW.rowRange(i * rows, (i + 1) * rows);
+	}
+
+	buildIndex();
+
+	return true;
+}
+
+bool ClusteredLinearRegression::save(const char* filename) const {
+	ModelFile file("ClusteredLinearRegression");
+	write(file);
+	return file.save(filename);
+}
+
+bool ClusteredLinearRegression::load(const char* filename) {
+	ModelFile file;
+	if (!file.load(filename) || file.type() != "ClusteredLinearRegression") return false;
+
+	return read(file);
+}
+
+/**
+ * 直近のクラスタの線形モデルを使って、データxに対応するyを計算する。
+ * xにバイアスを追加したコピーは作らず、Wの最終行をバイアスとして加算する。
+ *
+ * @param x			データx (D次元)
+ * @param y [OUT]	予測値 (K次元)
+ */
+void ClusteredLinearRegression::predictRow(const double* x, double* y) const {
+	int D = clusterCentroids.cols;
+
 	// 直近のクラスタを探す
-	float min_dist = std::numeric_limits<float>::max();
-	int min_id = -1;
-	for (int i = 0; i < clusterCentroids.size(); ++i) {
-		float dist = cv::norm((clusterCentroids[i] - x));
-		if (dist < min_dist) {
-			min_dist = dist;
-			min_id = i;
+	double min_dist;
+	int min_id = index.nearest(x, min_dist);
+
+	const cv::Mat_<double>& w = W[min_id];
+	for (int k = 0; k < w.cols; ++k) {
+		y[k] = w(D, k);
+		for (int c = 0; c < D; ++c) {
+			y[k] += x[c] * w(c, k);
 		}
 	}
+}
+
+
+/**
+ * 直近のクラスタの線形モデルを使って、データxに対応するyを単精度で計算する。
+ *
+ * @param x			データx (D次元)
+ * @param y [OUT]	予測値 (K次元)
+ */
+void ClusteredLinearRegression::predictRow(const float* x, float* y) const {
+	int D = clusterCentroids.cols;
 
-	cv::Mat_<double> x2 = x.clone();
-	ml::addBias(x2);
-	return x2 * W[min_id];
+	// 直近のクラスタを探す
+	float min_dist;
+	int min_id = floatIndex.nearest(x, min_dist);
+
+	const float* bias = floatW[min_id * (D + 1) + D];
+	for (int k = 0; k < floatW.cols; ++k) {
+		y[k] = bias[k];
+	}
+	for (int c = 0; c < D; ++c) {
+		const float* w = floatW[min_id * (D + 1) + c];
+		for (int k = 0; k < floatW.cols; ++k) {
+			y[k] += x[c] * w[k];
+		}
+	}
 }
 
+/**
+ * 重心の探索用indexを作り、単精度で推論するための重心と係数のコピーも作る。
+ */
+void ClusteredLinearRegression::buildIndex() {
+	index.build(clusterCentroids);
+
+	cv::Mat_<float> floatCentroids;
+	clusterCentroids.convertTo(floatCentroids, CV_32F);
+	floatIndex.build(floatCentroids);
+
+	int rows = clusterCentroids.cols + 1;
+	floatW.create(W.size() * rows, W.empty() ? 0 : W[0].cols);
+	for (int i = 0; i < W.size(); ++i) {
+		cv::Mat_<float> w = floatW.rowRange(i * rows, (i + 1) * rows);
+		W[i].convertTo(w, CV_32F);
+	}
+}
 
 /**
  * データXをk-meansクラスタリングで階層的に分割していく。
- * それに合わせて、データYも分割する。
- * データX、データYの行数は同じであること。
+ * X、indicesの[begin, end)の行を、ラベル0の行が前、ラベル1の行が後ろになるよう、その場で入れ替えてから、
+ * それぞれを並列に再帰的に分割する。
+ * クラスタは、左の枝から順にclustersに追加される。
  *
- * @param X						データX
- * @param Y						データY
- * @param indices				各データ要素の、元データでのindex番号
+ * @param X						データX (float、行はその場で入れ替える)
+ * @param indices				各データ要素の、元データでのindex番号 (Xと同じく入れ替える)
+ * @param begin					分割する範囲の開始行
+ * @param end					分割する範囲の終了行 (この行は含まない)
+ * @param centroid				分割する範囲の重心
  * @param minSize				クラスタの最小サイズ
- * @param clusterX [OUT]		データXのクラスタリング結果
- * @param clusterY [OUT]		データYのクラスタリング結果
- * @param clusterCentroids [OUT]	クラスタリング結果における各要素の、元データでのindex番号
+ * @param attempts				k-meansを試す回数
+ * @param iterations			k-meansの最大反復回数
+ * @param seed					k-meansの初期値に使う乱数のシード
+ * @param clusters [OUT]		クラスタリング結果
  */
-void ClusteredLinearRegression::partition(const cv::Mat_<float>& X, const cv::Mat_<float>& Y, const cv::Mat_<float>& centroid, int minSize, vector<cv::Mat_<float> >&clusterX, vector<cv::Mat_<float> >&clusterY, vector<cv::Mat_<float> >& clusterCentroids) {
-	// サンプル数がminSize未満になるまで、繰り返し、X、Yを分割する。
-	cv::Mat samples;
-	X.convertTo(samples, CV_32F);
+void ClusteredLinearRegression::partition(cv::Mat_<float>& X, vector<int>& indices, int begin, int end, const cv::Mat_<double>& centroid, int minSize, int attempts, int iterations, unsigned long long seed, vector<Cluster>& clusters) {
+	Cluster cluster;
+	cluster.begin = begin;
+	cluster.end = end;
+	cluster.centroid = centroid;
+
+	// どう分割してもminSize未満のクラスタができるなら、k-meansは行わない
+	if (end - begin < std::max(2, minSize * 2)) {
+		clusters.push_back(cluster);
+		return;
+	}
+
+	// サンプル数がminSize未満になるまで、繰り返し、Xを分割する。
+	cv::Mat_<float> samples = X.rowRange(begin, end);
 	cv::Mat_<float> centroids;
 	cv::Mat labels;
-	//cv::TermCriteria cri(cv::TermCriteria::MAX_ITER | cv::TermCriteria::EPS, 50, FLT_EPSILON);
-	cv::TermCriteria cri(cv::TermCriteria::COUNT, 200, FLT_EPSILON);
-	double compactness = cv::kmeans(samples, 2, labels, cri, 200, cv::KMEANS_PP_CENTERS, centroids);
-		
+	cv::TermCriteria cri(cv::TermCriteria::COUNT, iterations, FLT_EPSILON);
+
+	// cv::theRNG()はスレッドごとなので、どのスレッドで実行しても同じ結果となるよう、分割する範囲からシードを決める
+	cv::theRNG() = cv::RNG(seed ^ ((unsigned long long)begin << 32 | (unsigned int)end));
+	cv::kmeans(samples, 2, labels, cri, attempts, cv::KMEANS_PP_CENTERS, centroids);
+
 	int nClass1 = cv::countNonZero(labels);
-	int nClass0 = X.rows - nClass1;
+	int nClass0 = samples.rows - nClass1;
 
 	if (nClass1 < minSize || nClass0 < minSize) {
-		clusterX.push_back(X);
-		clusterY.push_back(Y);
-		clusterCentroids.push_back(centroid); 
+		clusters.push_back(cluster);
 		return;
 	}
 
-	cv::Mat_<float> classX0(nClass0, X.cols);
-	cv::Mat_<float> classX1(nClass1, X.cols);
-	cv::Mat_<float> classY0(nClass0, Y.cols);
-	cv::Mat_<float> classY1(nClass1, Y.cols);
-
-	int index0 = 0;
-	int index1 = 0;
-	for (int r = 0; r < X.rows; ++r) {
-		if (labels.at<float>(r, 0) == 0) {
-			for (int c = 0; c < X.cols; ++c) {
-				classX0(index0, c) = X(r, c);
-			}
-			for (int c = 0; c < Y.cols; ++c) {
-				classY0(index0, c) = Y(r, c);
-			}
+	// ラベル0の行を前に、ラベル1の行を後ろに集める
+	vector<float> tmp(X.cols);
+	int i = 0;
+	int j = samples.rows - 1;
+	while (true) {
+		while (i < j && labels.at<int>(i, 0) == 0) ++i;
+		while (i < j && labels.at<int>(j, 0) != 0) --j;
+		if (i >= j) break;
 
-			index0++;
-		} else {
-			for (int c = 0; c < X.cols; ++c) {
-				classX1(index1, c) = X(r, c);
-			}
-			for (int c = 0; c < Y.cols; ++c) {
-				classY1(index1, c) = Y(r, c);
-			}
+		memcpy(&tmp[0], samples[i], sizeof(float) * X.cols);
+		memcpy(samples[i], samples[j], sizeof(float) * X.cols);
+		memcpy(samples[j], &tmp[0], sizeof(float) * X.cols);
+		std::swap(indices[begin + i], indices[begin + j]);
+		std::swap(labels.at<int>(i, 0), labels.at<int>(j, 0));
+		++i;
+		--j;
+	}
+
+	int mid = begin + nClass0;
+	cv::Mat_<double> centroid0, centroid1;
+	centroids.row(0).convertTo(centroid0, CV_64F);
+	centroids.row(1).convertTo(centroid1, CV_64F);
 
-			index1++;
+	vector<Cluster> clusters0, clusters1;
+	ThreadPool::instance().parallelFor(0, 2, [&](int first, int last) {
+		for (int k = first; k < last; ++k) {
+			if (k == 0) {
+				partition(X, indices, begin, mid, centroid0, minSize, attempts, iterations, seed, clusters0);
+			} else {
+				partition(X, indices, mid, end, centroid1, minSize, attempts, iterations, seed, clusters1);
+			}
 		}
-	}
+	}, 2);
 
-	partition(classX0, classY0, centroids.row(0), minSize, clusterX, clusterY, clusterCentroids);
-	partition(classX1, classY1, centroids.row(1), minSize, clusterX, clusterY, clusterCentroids);
+	clusters.insert(clusters.end(), clusters0.begin(), clusters0.end());
+	clusters.insert(clusters.end(), clusters1.begin(), clusters1.end());
 }
-
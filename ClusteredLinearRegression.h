@@ -2,21 +2,44 @@
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
+#include "KDTree.h"
 
 using namespace std;
 
+class ModelFile;
+
 class ClusteredLinearRegression {
 private:
-	vector<cv::Mat_<double> > clusterCentroids;
+	struct Cluster {
+		int begin;					// indicesの開始位置
+		int end;					// indicesの終了位置 (この位置は含まない)
+		cv::Mat_<double> centroid;
+	};
+
+	cv::Mat_<double> clusterCentroids;		// 各クラスタの重心 (クラスタ数 x D、連続領域)
+	KDTree index;							// clusterCentroidsの探索用index
 	vector<cv::Mat_<double> > W;
+	KDTreeF floatIndex;						// 単精度で推論するための、clusterCentroidsの探索用index
+	cv::Mat_<float> floatW;					// 単精度で推論するための、各クラスタの係数を縦に連結したもの
 
 public:
-	ClusteredLinearRegression(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, int minClusterSize);
+	ClusteredLinearRegression();
+	ClusteredLinearRegression(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, int minClusterSize, int kmeansAttempts = 200, int kmeansIterations = 200, unsigned long long seed = 1);
 
 public:
-	cv::Mat_<double> predict(const cv::Mat_<double>& x);
+	cv::Mat_<double> predict(const cv::Mat_<double>& x) const;
+	cv::Mat_<double> predictBatch(const cv::Mat_<double>& X, int numThreads = 0) const;
+	cv::Mat_<float> predictBatchFloat(const cv::Mat_<float>& X, int numThreads = 0) const;
+	double floatRmse(const cv::Mat_<double>& X, int numThreads = 0) const;
+	void write(ModelFile& file) const;
+	bool read(const ModelFile& file);
+	bool save(const char* filename) const;
+	bool load(const char* filename);
 
 private:
-	void partition(const cv::Mat_<float>& X, const cv::Mat_<float>& Y, const cv::Mat_<float>& centroid, int minSize, vector<cv::Mat_<float> >&clusterX, vector<cv::Mat_<float> >&clusterY, vector<cv::Mat_<float> >& clusterCentroids);
+	void predictRow(const double* x, double* y) const;
+	void predictRow(const float* x, float* y) const;
+	void buildIndex();
+	void partition(cv::Mat_<float>& X, vector<int>& indices, int begin, int end, const cv::Mat_<double>& centroid, int minSize, int attempts, int iterations, unsigned long long seed, vector<Cluster>& clusters);
 };
 
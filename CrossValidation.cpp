@@ -0,0 +1,263 @@
+﻿#include "CrossValidation.h"
+#include "MLUtils.h"
+#include "ThreadPool.h"
+#include "Random.h"
+#include "LocalLinearRegression.h"
+#include "LinearRegressionRegularization.h"
+#include "ClusteredLinearRegression.h"
+#include "LinearInterpolation.h"
+#include <cstring>
+#include <limits>
+#include <atomic>
+#include <iostream>
+
+using namespace std;
+
+/**
+ * データをシードに従って並べ替え、folds個のfoldに分ける。
+ * foldの数は2以上、データ数以下に制限する。
+ * データ数が2未満、またはXとYの行数が異なる場合は、エラーを表示して空のままとする (folds()は0となる)。
+ *
+ * @param X			データX (N x D)
+ * @param Y			データY (N x K)
+ * @param folds		foldの数
+ * @param seed		並べ替えに使う乱数のシード
+ */
+CrossValidation::CrossValidation(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, int folds, unsigned long long seed) {
+	int N = X.rows;
+	if (N < 2) {
+		cerr << "CrossValidation: at least 2 rows are required, but got " << N << endl;
+		return;
+	}
+	if (Y.rows != N) {
+		cerr << "CrossValidation: X has " << N << " rows, but Y has " << Y.rows << endl;
+		return;
+	}
+	folds = std::max(2, std::min(folds, N));
+
+	// Fisher-Yatesで並べ替える
+	permutation.resize(N);
+	for (int i = 0; i < N; ++i) {
+		permutation[i] = i;
+	}
+	Random rng(seed);
+	for (int i = N - 1; i > 0; --i) {
+		std::swap(permutation[i], permutation[rng.uniformInt(i + 1)]);
+	}
+
+	X2.create(N * 2, X.cols);
+	Y2.create(N * 2, Y.cols);
+	for (int r = 0; r < N; ++r) {
+		memcpy(X2[r], X[permutation[r]], sizeof(double) * X.cols);
+		memcpy(Y2[r], Y[permutation[r]], sizeof(double) * Y.cols);
+	}
+	X2.rowRange(0, N).copyTo(X2.rowRange(N, N * 2));
+	Y2.rowRange(0, N).copyTo(Y2.rowRange(N, N * 2));
+
+	bounds.resize(folds + 1);
+	for (int i = 0; i <= folds; ++i) {
+		bounds[i] = (long long)N * i / folds;
+	}
+}
+
+int CrossValidation::folds() const {
+	return bounds.empty() ? 0 : bounds.size() - 1;
+}
+
+/**
+ * データ数を返却する。
+ */
+int CrossValidation::size() const {
+	return permutation.size();
+}
+
+/**
+ * 並べ替えた後の各行の、元データでの行番号を返却する。
+ * fold iの検証データは、この配列の[N i / k, N (i + 1) / k)番目の行。
+ */
+const vector<int>& CrossValidation::indices() const {
+	return permutation;
+}
+
+/**
+ * fold iの学習データと検証データを、コピーせずにビューとして返却する。
+ *
+ * @param i					foldの番号
+ * @param trainX [OUT]		学習データX
+ * @param trainY [OUT]		学習データY
+ * @param testX [OUT]		検証データX
+ * @param testY [OUT]		検証データY
+ */
+void CrossValidation::fold(int i, cv::Mat_<double>& trainX, cv::Mat_<double>& trainY, cv::Mat_<double>& testX, cv::Mat_<double>& testY) const {
+	int N = size();
+	int begin = bounds[i];
+	int end = bounds[i + 1];
+
+	testX = X2.rowRange(begin, end);
+	testY = Y2.rowRange(begin, end);
+	trainX = X2.rowRange(end, N + begin);
+	trainY = Y2.rowRange(end, N + begin);
+}
+
+/**
+ * 1つのパラメータについて、交差検証のRMSEを計算する。
+ *
+ * @param model				モデル
+ * @param params			パラメータ
+ * @param averageColumns	ml::rmseのaverageColumns
+ * @param numThreads		使用するスレッド数 (searchを参照)
+ * @return					RMSE (パラメータが空ならNaN)
+ */
+double CrossValidation::evaluate(const Model& model, const vector<double>& params, bool averageColumns, int numThreads) const {
+	vector<vector<double> > grid(params.size());
+	for (int i = 0; i < params.size(); ++i) {
+		grid[i].push_back(params[i]);
+	}
+
+	vector<Result> results = search(model, grid, averageColumns, numThreads);
+	return results.empty() ? std::numeric_limits<double>::quiet_NaN() : results[0].rmse;
+}
+
+/**
+ * パラメータのグリッドの全ての組み合わせについて、交差検証のRMSEを計算する。
+ * grid[j]はj番目のパラメータの候補で、結果は最後のパラメータが最も速く変わる順に並ぶ。
+ * (組み合わせ, fold)の各組を1つのタスクとしてスレッドプールで並列に実行し、
+ * 各foldの予測値を、組み合わせごとの予測値の行列の、検証データの位置に書き込む。
+ * 予測値の行数が検証データと異なる場合、その組み合わせのRMSEはNaNとなる。
+ * foldがない (データ数が2未満) 場合は、全ての組み合わせのRMSEがNaNとなる。
+ * パラメータがない、または候補が空のパラメータがある場合は、エラーを表示して空の結果を返却する。
+ *
+ * @param model				モデル
+ * @param grid				各パラメータの候補
+ * @param averageColumns	ml::rmseのaverageColumns
+ * @param numThreads		タスクを分ける数 (0なら各タスクを別々にキューに入れる)
+ * @return					組み合わせごとのパラメータとRMSE
+ */
+vector<CrossValidation::Result> CrossValidation::search(const Model& model, const vector<vector<double> >& grid, bool averageColumns, int numThreads) const {
+	int N = size();
+	int K = Y2.cols;
+	int k = folds();
+
+	if (grid.empty()) {
+		cerr << "CrossValidation: the parameter grid is empty" << endl;
+		return vector<Result>();
+	}
+	for (int j = 0; j < grid.size(); ++j) {
+		if (grid[j].empty()) {
+			cerr << "CrossValidation: parameter " << j << " has no candidates" << endl;
+			return vector<Result>();
+		}
+	}
+
+	// グリッドを展開する
+	vector<Result> results(1);
+	for (int j = 0; j < grid.size(); ++j) {
+		vector<Result> expanded;
+		for (int c = 0; c < results.size(); ++c) {
+			for (int v = 0; v < grid[j].size(); ++v) {
+				Result result = results[c];
+				result.params.push_back(grid[j][v]);
+				expanded.push_back(result);
+			}
+		}
+		results.swap(expanded);
+	}
+
+	if (k == 0) {
+		for (int c = 0; c < results.size(); ++c) {
+			results[c].rmse = std::numeric_limits<double>::quiet_NaN();
+		}
+		return results;
+	}
+
+	vector<cv::Mat_<double> > predictions(results.size());
+	// 同じ組み合わせの別のfoldのタスクから同時に書き込まれるので、atomicにする
+	vector<std::atomic<char> > failed(results.size());
+	for (int c = 0; c < results.size(); ++c) {
+		predictions[c].create(N, K);
+		failed[c] = 0;
+	}
+
+	int tasks = results.size() * k;
+	ThreadPool::instance().parallelFor(0, tasks, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t) {
+			int c = t / k;
+			int f = t % k;
+
+			cv::Mat_<double> trainX, trainY, testX, testY;
+			fold(f, trainX, trainY, testX, testY);
+
+			cv::Mat_<double> predicted = model(results[c].params, trainX, trainY, testX);
+			if (predicted.rows != testX.rows || predicted.cols != K) {
+				failed[c] = 1;
+				continue;
+			}
+			cv::Mat_<double> dst = predictions[c].rowRange(bounds[f], bounds[f + 1]);
+			predicted.copyTo(dst);
+		}
+	}, numThreads > 0 ? numThreads : tasks);
+
+	cv::Mat_<double> Y = Y2.rowRange(0, N);
+	for (int c = 0; c < results.size(); ++c) {
+		results[c].rmse = failed[c] ? std::numeric_limits<double>::quiet_NaN() : ml::rmse(Y, predictions[c], averageColumns);
+	}
+
+	return results;
+}
+
+/**
+ * RMSEが最小の組み合わせの番号を返却する (NaNは除く。なければ-1)。
+ */
+int CrossValidation::best(const vector<Result>& results) {
+	int index = -1;
+	for (int c = 0; c < results.size(); ++c) {
+		if (results[c].rmse != results[c].rmse) continue;
+		if (index < 0 || results[c].rmse < results[index].rmse) index = c;
+	}
+	return index;
+}
+
+/**
+ * LocalLinearRegressionのモデル。params[0]はsigma。
+ */
+CrossValidation::Model CrossValidation::localLinearRegression() {
+	return [](const vector<double>& params, const cv::Mat_<double>& trainX, const cv::Mat_<double>& trainY, const cv::Mat_<double>& testX) {
+		LocalLinearRegression llr(trainX, trainY, params[0]);
+		return llr.predictBatch(testX, 1);
+	};
+}
+
+/**
+ * LinearRegressionRegularizationのモデル。params[0]はlambda、params[1]はalpha (OPTIMIZER_RIDGEでは省略可)。
+ * バイアスが必要な場合は、Xにバイアス列を追加しておく。
+ */
+CrossValidation::Model CrossValidation::linearRegressionRegularization(int maxIter, int optimizer, int batchSize, double tol) {
+	return [=](const vector<double>& params, const cv::Mat_<double>& trainX, const cv::Mat_<double>& trainY, const cv::Mat_<double>& testX) {
+		LinearRegressionRegularization lrr;
+		lrr.train(trainX, trainY, params[0], params.size() > 1 ? params[1] : 0.0, maxIter, optimizer, batchSize, tol);
+		return lrr.predictBatch(testX, 1);
+	};
+}
+
+/**
+ * ClusteredLinearRegressionのモデル。params[0]はminClusterSize。
+ */
+CrossValidation::Model CrossValidation::clusteredLinearRegression(int kmeansAttempts, int kmeansIterations) {
+	return [=](const vector<double>& params, const cv::Mat_<double>& trainX, const cv::Mat_<double>& trainY, const cv::Mat_<double>& testX) {
+		ClusteredLinearRegression clr(trainX, trainY, (int)params[0], kmeansAttempts, kmeansIterations);
+		return clr.predictBatch(testX, 1);
+	};
+}
+
+/**
+ * LinearInterpolationのモデル。params[0]はalpha。
+ *
+ * @param mode	LinearInterpolation::MODE_KNN / LinearInterpolation::MODE_DELAUNAY
+ */
+CrossValidation::Model CrossValidation::linearInterpolation(int mode) {
+	return [=](const vector<double>& params, const cv::Mat_<double>& trainX, const cv::Mat_<double>& trainY, const cv::Mat_<double>& testX) {
+		LinearInterpolation li(trainX, trainY, params[0], mode);
+		return li.predictBatch(testX, 1);
+	};
+}
+
@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <vector>
+#include <functional>
+#include <opencv/cv.h>
+#include "LinearInterpolation.h"
+
+/**
+ * k-fold交差検証と、ハイパーパラメータのグリッドサーチ。
+ * データは最初に1度だけ並べ替えて、2回繰り返した行列 (2N行) として保持する。
+ * fold iの検証データは[b, e)、学習データは[e, N + b)の連続した行になるので、
+ * 各foldのデータはコピーせずに、rowRangeのビューとして渡せる。
+ */
+class CrossValidation {
+public:
+	/**
+	 * モデル。paramsのパラメータで(trainX, trainY)から学習し、testXの予測値 (testX.rows x K) を返却する。
+	 * 複数のスレッドから同時に呼び出されるので、共有する状態を変更してはいけない。
+	 */
+	typedef std::function<cv::Mat_<double>(const std::vector<double>& params, const cv::Mat_<double>& trainX, const cv::Mat_<double>& trainY, const cv::Mat_<double>& testX)> Model;
+
+	struct Result {
+		std::vector<double> params;	// パラメータ
+		double rmse;				// 全foldの検証データに対する予測値のRMSE (ml::rmse)
+	};
+
+private:
+	cv::Mat_<double> X2;			// 並べ替えたXを2回繰り返したもの (2N x D)
+	cv::Mat_<double> Y2;			// 並べ替えたYを2回繰り返したもの (2N x K)
+	std::vector<int> permutation;	// X2のr行目 (r < N) の、元データでの行番号
+	std::vector<int> bounds;		// fold iの検証データは[bounds[i], bounds[i + 1])
+
+public:
+	CrossValidation(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, int folds, unsigned long long seed = 1);
+
+	int folds() const;
+	int size() const;
+	const std::vector<int>& indices() const;
+	void fold(int i, cv::Mat_<double>& trainX, cv::Mat_<double>& trainY, cv::Mat_<double>& testX, cv::Mat_<double>& testY) const;
+
+	double evaluate(const Model& model, const std::vector<double>& params, bool averageColumns = false, int numThreads = 0) const;
+	std::vector<Result> search(const Model& model, const std::vector<std::vector<double> >& grid, bool averageColumns = false, int numThreads = 0) const;
+	static int best(const std::vector<Result>& results);
+
+	static Model localLinearRegression();
+	static Model linearRegressionRegularization(int maxIter, int optimizer, int batchSize = 0, double tol = 0.0);
+	static Model clusteredLinearRegression(int kmeansAttempts = 200, int kmeansIterations = 200);
+	static Model linearInterpolation(int mode = LinearInterpolation::MODE_KNN);
+};
+
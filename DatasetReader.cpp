@@ -0,0 +1,117 @@
+﻿#include "DatasetReader.h"
+#include "MLUtils.h"
+
+using namespace std;
+
+DatasetReader::DatasetReader() : binary(false), rows(0), numCols(0), rowsRead(0) {
+}
+
+DatasetReader::DatasetReader(const char* filename, bool binary) : binary(false), rows(0), numCols(0), rowsRead(0) {
+	open(filename, binary);
+}
+
+/**
+ * ファイルを開き、列数を調べる。
+ * もしファイルがオープンできない場合は、falseを返却する。
+ *
+ * @param filename		ファイル名
+ * @param binary		trueならバイナリ形式
+ */
+bool DatasetReader::open(const char* filename, bool binary) {
+	close();
+	this->binary = binary;
+
+	if (binary) {
+		ifs.open(filename, ios::binary);
+		if (ifs.fail()) return false;
+
+		if (!ml::readDatasetHeader(ifs, header)) {
+			close();
+			return false;
+		}
+		rows = header.rows;
+		numCols = header.cols;
+	} else {
+		ifs.open(filename);
+		if (ifs.fail()) return false;
+
+		rows = -1;
+		std::string str;
+		if (getline(ifs, str) && !ml::parseDatasetLine(str, pending)) {
+			pending.clear();
+		}
+		numCols = pending.size();
+	}
+
+	return true;
+}
+
+void DatasetReader::close() {
+	if (ifs.is_open()) ifs.close();
+	ifs.clear();
+	rows = 0;
+	numCols = 0;
+	rowsRead = 0;
+	pending.clear();
+}
+
+bool DatasetReader::isOpen() const {
+	return ifs.is_open();
+}
+
+int DatasetReader::cols() const {
+	return numCols;
+}
+
+/**
+ * 次の最大maxRows行を読み込み、bufferの先頭の行に格納する。
+ * bufferは maxRows x cols() の大きさになる (同じ大きさなら、再確保はしない)。
+ * 読み込んだ行数を返却し、ファイルの終わりに達したら0を返却する。
+ * テキスト形式で空行、数値として読めない行、列数の異なる行があった場合は、その手前で終わりとする。
+ * バイナリ形式でヘッダの行数より前にファイルが終わっている場合は、読めた行数を返却し、以降の呼び出しでは-1を返却する。
+ *
+ * @param maxRows			読み込む最大の行数
+ * @param buffer [OUT]		読み込み先
+ * @return					読み込んだ行数 (失敗した場合は-1)
+ */
+int DatasetReader::read(int maxRows, cv::Mat_<double>& buffer) {
+	buffer.create(maxRows, numCols);
+	if (!ifs.is_open() || numCols == 0) return 0;
+
+	int n = 0;
+	if (binary) {
+		n = std::min(maxRows, rows - rowsRead);
+		if (n <= 0) return 0;
+
+		if (!ml::readDatasetValues(ifs, header, (double*)buffer.data, (long long)n * numCols)) {
+			// ファイルが途中で切れている場合は、最後まで読めた行のみ返却する
+			int elemSize = header.dtype == CV_32F ? sizeof(float) : sizeof(double);
+			n = ifs.gcount() / ((long long)elemSize * numCols);
+			if (n == 0) return -1;
+		}
+	} else {
+		if (!pending.empty()) {
+			for (int c = 0; c < numCols; ++c) {
+				buffer(0, c) = pending[c];
+			}
+			pending.clear();
+			n++;
+		}
+
+		std::string str;
+		vector<double> rec;
+		while (n < maxRows && getline(ifs, str)) {
+			if (!ml::parseDatasetLine(str, rec) || rec.size() != numCols) {
+				ifs.setstate(ios::eofbit);
+				break;
+			}
+			for (int c = 0; c < numCols; ++c) {
+				buffer(n, c) = rec[c];
+			}
+			n++;
+		}
+	}
+
+	rowsRead += n;
+	return n;
+}
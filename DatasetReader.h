@@ -0,0 +1,33 @@
+﻿#pragma once
+
+#include <fstream>
+#include <vector>
+#include <opencv/cv.h>
+#include "MLUtils.h"
+
+/**
+ * データセットのファイルを、先頭から何行かずつ読み込む。
+ * ml::loadDatasetと同じテキスト形式、バイナリ形式に対応する。
+ * ファイル全体をメモリに載せないので、メモリに収まらないデータセットも扱える。
+ */
+class DatasetReader {
+private:
+	std::ifstream ifs;
+	bool binary;
+	ml::DatasetHeader header;	// バイナリ形式のヘッダ
+	int rows;					// 全体の行数 (テキスト形式では不明なので-1)
+	int numCols;
+	int rowsRead;
+	std::vector<double> pending;	// テキスト形式で、列数を調べるために先読みした行
+
+public:
+	DatasetReader();
+	DatasetReader(const char* filename, bool binary = false);
+
+	bool open(const char* filename, bool binary = false);
+	void close();
+	bool isOpen() const;
+	int cols() const;
+	int read(int maxRows, cv::Mat_<double>& buffer);
+};
+
@@ -0,0 +1,297 @@
+﻿#include "DelaunayTriangulation.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+DelaunayTriangulation::DelaunayTriangulation() : lastLocated(0) {
+}
+
+DelaunayTriangulation::DelaunayTriangulation(const cv::Mat_<double>& X) : lastLocated(0) {
+	build(X);
+}
+
+DelaunayTriangulation::DelaunayTriangulation(const DelaunayTriangulation& other) : points(other.points), triangles(other.triangles), lastLocated(0) {
+}
+
+DelaunayTriangulation& DelaunayTriangulation::operator=(const DelaunayTriangulation& other) {
+	points = other.points;
+	triangles = other.triangles;
+	lastLocated = 0;
+	return *this;
+}
+
+/**
+ * 2次元の点群XのDelaunay三角形分割を作る。
+ * 全ての点を含む大きな三角形から始めて、1点ずつ追加する (Bowyer-Watson法)。
+ * 直前に追加した点の近くから探索を始められるよう、点は格子状に蛇行する順に追加する。
+ * 既にある頂点と同じ位置の点は追加しない。
+ *
+ * @param X		点群 (N x 2)
+ */
+void DelaunayTriangulation::build(const cv::Mat_<double>& X) {
+	triangles.clear();
+	int N = X.rows;
+	if (N < 3 || X.cols != 2) {
+		points.release();
+		return;
+	}
+
+	points.create(N + 3, 2);
+	X.copyTo(points.rowRange(0, N));
+
+	// 全ての点を含む大きな三角形
+	double minX, maxX, minY, maxY;
+	cv::minMaxLoc(X.col(0), &minX, &maxX);
+	cv::minMaxLoc(X.col(1), &minY, &maxY);
+	double cx = (minX + maxX) * 0.5;
+	double cy = (minY + maxY) * 0.5;
+	double size = std::max(std::max(maxX - minX, maxY - minY), 1e-12);
+	points(N, 0) = cx - 100 * size;
+	points(N, 1) = cy - 100 * size;
+	points(N + 1, 0) = cx + 100 * size;
+	points(N + 1, 1) = cy - 100 * size;
+	points(N + 2, 0) = cx;
+	points(N + 2, 1) = cy + 100 * size;
+
+	Triangle super;
+	for (int i = 0; i < 3; ++i) {
+		super.v[i] = N + i;
+		super.adj[i] = -1;
+	}
+	triangles.push_back(super);
+
+	// 追加する順番 (格子の行ごとに、x方向を交互に反転する)
+	int bins = std::max(1, (int)sqrt(N / 4.0));
+	vector<pair<pair<int, double>, int> > order(N);
+	for (int i = 0; i < N; ++i) {
+		int bin = std::min(bins - 1, (int)((X(i, 1) - minY) / (maxY - minY + 1e-300) * bins));
+		order[i] = make_pair(make_pair(bin, bin % 2 == 0 ? X(i, 0) : -X(i, 0)), i);
+	}
+	sort(order.begin(), order.end());
+
+	int hint = 0;
+	vector<int> stamps(1, -1);
+	for (int i = 0; i < N; ++i) {
+		insert(order[i].second, hint, stamps);
+	}
+
+	// 外側の大きな三角形の頂点を含む三角形を削除し、隣接関係を付け直す
+	vector<int> newIndex(triangles.size(), -1);
+	int count = 0;
+	for (int t = 0; t < triangles.size(); ++t) {
+		const Triangle& tri = triangles[t];
+		if (tri.v[0] < N && tri.v[1] < N && tri.v[2] < N) {
+			newIndex[t] = count++;
+		}
+	}
+
+	vector<Triangle> result(count);
+	for (int t = 0; t < triangles.size(); ++t) {
+		if (newIndex[t] < 0) continue;
+
+		Triangle tri = triangles[t];
+		for (int i = 0; i < 3; ++i) {
+			if (tri.adj[i] >= 0) tri.adj[i] = newIndex[tri.adj[i]];
+		}
+		result[newIndex[t]] = tri;
+	}
+	triangles.swap(result);
+}
+
+bool DelaunayTriangulation::empty() const {
+	return triangles.empty();
+}
+
+/**
+ * 三角形の数を返却する。
+ */
+int DelaunayTriangulation::size() const {
+	return triangles.size();
+}
+
+const DelaunayTriangulation::Triangle& DelaunayTriangulation::triangle(int index) const {
+	return triangles[index];
+}
+
+/**
+ * xを含む三角形を探し、その頂点に対する重心座標を返却する。
+ * 直前に見つけた三角形から探し始めるので、近い点を続けて探す場合は速い。
+ * 開始位置は三角形分割ごとに持つので、複数の分割を交互に使っても互いに影響しない。
+ *
+ * @param x					点 (2次元)
+ * @param weights [OUT]		三角形の頂点v[0]、v[1]、v[2]に対する重み (合計1)
+ * @return					三角形のindex番号 (凸包の外なら-1)
+ */
+int DelaunayTriangulation::locate(const double* x, double* weights) const {
+	if (triangles.empty()) return -1;
+
+	// 複数のスレッドから呼ばれても良いよう、開始位置はatomicに読み書きする (値は探索の速さにしか影響しない)
+	int hint = lastLocated.load(std::memory_order_relaxed);
+	if (hint >= (int)triangles.size()) hint = 0;
+
+	int t = walk(hint, x);
+	if (t < 0) return -1;
+	lastLocated.store(t, std::memory_order_relaxed);
+
+	const Triangle& tri = triangles[t];
+	double area = orient(tri.v[0], tri.v[1], points[tri.v[2]]);
+	weights[0] = orient(tri.v[1], tri.v[2], x) / area;
+	weights[1] = orient(tri.v[2], tri.v[0], x) / area;
+	weights[2] = 1.0 - weights[0] - weights[1];
+
+	return t;
+}
+
+/**
+ * 点pointsのindex行目を分割に追加する。
+ * 外接円がその点を含む三角形 (空洞) を隣接関係でたどって集め、空洞の境界の各辺と点を結ぶ三角形で置き換える。
+ *
+ * @param index			追加する点のindex番号
+ * @param hint [IN/OUT]	探索を始める三角形 (追加後は、新しく作った三角形)
+ * @param stamps		各三角形が空洞に含まれるかの印 (作業領域)
+ */
+void DelaunayTriangulation::insert(int index, int& hint, vector<int>& stamps) {
+	const double* p = points[index];
+
+	int start = walk(hint, p);
+	if (start < 0 || !inCircle(triangles[start], p)) return;
+
+	// 空洞を集める
+	vector<int> cavity(1, start);
+	stamps.resize(triangles.size(), -1);
+	stamps[start] = index;
+	for (int i = 0; i < cavity.size(); ++i) {
+		const Triangle& tri = triangles[cavity[i]];
+		for (int j = 0; j < 3; ++j) {
+			int n = tri.adj[j];
+			if (n < 0 || stamps[n] == index) continue;
+			if (inCircle(triangles[n], p)) {
+				stamps[n] = index;
+				cavity.push_back(n);
+			}
+		}
+	}
+
+	// 空洞の境界の辺 (a, b) と、その外側の三角形
+	struct Edge {
+		int a;
+		int b;
+		int outer;
+	};
+	vector<Edge> boundary;
+	for (int i = 0; i < cavity.size(); ++i) {
+		const Triangle& tri = triangles[cavity[i]];
+		for (int j = 0; j < 3; ++j) {
+			int n = tri.adj[j];
+			if (n >= 0 && stamps[n] == index) continue;
+
+			Edge edge = { tri.v[(j + 1) % 3], tri.v[(j + 2) % 3], n };
+			boundary.push_back(edge);
+		}
+	}
+
+	// 新しい三角形は、空洞の三角形の領域を使い回し、足りない分を追加する
+	vector<int> slots = cavity;
+	while (slots.size() < boundary.size()) {
+		slots.push_back(triangles.size());
+		triangles.push_back(Triangle());
+	}
+	stamps.resize(triangles.size(), -1);
+
+	for (int i = 0; i < boundary.size(); ++i) {
+		const Edge& edge = boundary[i];
+		Triangle& tri = triangles[slots[i]];
+		tri.v[0] = edge.a;
+		tri.v[1] = edge.b;
+		tri.v[2] = index;
+		tri.adj[2] = edge.outer;
+
+		// 外側の三角形の隣接関係を付け直す
+		if (edge.outer >= 0) {
+			Triangle& outer = triangles[edge.outer];
+			for (int j = 0; j < 3; ++j) {
+				if (outer.v[(j + 1) % 3] == edge.b && outer.v[(j + 2) % 3] == edge.a) {
+					outer.adj[j] = slots[i];
+					break;
+				}
+			}
+		}
+	}
+
+	// 新しい三角形どうしの隣接関係 (点indexの周りに扇状に並ぶ)
+	for (int i = 0; i < boundary.size(); ++i) {
+		Triangle& tri = triangles[slots[i]];
+		for (int j = 0; j < boundary.size(); ++j) {
+			if (boundary[j].a == boundary[i].b) tri.adj[0] = slots[j];
+			if (boundary[j].b == boundary[i].a) tri.adj[1] = slots[j];
+		}
+	}
+
+	hint = slots[0];
+}
+
+/**
+ * startの三角形から、xの方向にある辺を越えて隣の三角形へ進み、xを含む三角形を探す。
+ * Delaunay三角形分割ではこの探索は循環しないが、数値誤差に備えて、歩数が三角形の数を超えたら全ての三角形を調べる。
+ * 外側の大きな三角形を取り除いた後の分割は凸とは限らず、境界の辺を越えた先が凸包の内側のこともあるので、
+ * 隣接する三角形がない辺に出た場合も、全ての三角形を調べる。
+ *
+ * @param start		探索を始める三角形
+ * @param x			点 (2次元)
+ * @return			三角形のindex番号 (凸包の外なら-1)
+ */
+int DelaunayTriangulation::walk(int start, const double* x) const {
+	int t = start;
+	for (int steps = 0; steps < triangles.size(); ++steps) {
+		const Triangle& tri = triangles[t];
+
+		int next = t;
+		for (int i = 0; i < 3; ++i) {
+			if (orient(tri.v[(i + 1) % 3], tri.v[(i + 2) % 3], x) < 0) {
+				next = tri.adj[i];
+				break;
+			}
+		}
+
+		if (next == t) return t;
+		if (next < 0) break;
+		t = next;
+	}
+
+	for (t = 0; t < triangles.size(); ++t) {
+		const Triangle& tri = triangles[t];
+		if (orient(tri.v[0], tri.v[1], x) >= 0 && orient(tri.v[1], tri.v[2], x) >= 0 && orient(tri.v[2], tri.v[0], x) >= 0) return t;
+	}
+
+	return -1;
+}
+
+/**
+ * 頂点a、bを通る直線に対して、xが左側なら正、右側なら負の値を返却する (三角形abxの符号付き面積の2倍)。
+ */
+double DelaunayTriangulation::orient(int a, int b, const double* x) const {
+	const double* pa = points[a];
+	const double* pb = points[b];
+	return (pb[0] - pa[0]) * (x[1] - pa[1]) - (pb[1] - pa[1]) * (x[0] - pa[0]);
+}
+
+/**
+ * xが三角形tの外接円の内部 (円周上は含まない) にあればtrueを返却する。
+ */
+bool DelaunayTriangulation::inCircle(const Triangle& t, const double* x) const {
+	const double* a = points[t.v[0]];
+	const double* b = points[t.v[1]];
+	const double* c = points[t.v[2]];
+
+	double adx = a[0] - x[0], ady = a[1] - x[1];
+	double bdx = b[0] - x[0], bdy = b[1] - x[1];
+	double cdx = c[0] - x[0], cdy = c[1] - x[1];
+
+	double ad = adx * adx + ady * ady;
+	double bd = bdx * bdx + bdy * bdy;
+	double cd = cdx * cdx + cdy * cdy;
+
+	return adx * (bdy * cd - bd * cdy) - ady * (bdx * cd - bd * cdx) + ad * (bdx * cdy - bdy * cdx) > 0;
+}
+
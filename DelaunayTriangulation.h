@@ -0,0 +1,41 @@
+﻿#pragma once
+
+#include <vector>
+#include <atomic>
+#include <opencv/cv.h>
+
+/**
+ * 2次元のDelaunay三角形分割。
+ * Bowyer-Watson法で一度だけ分割を作り、点を含む三角形を隣接三角形をたどって (walk) 探す。
+ */
+class DelaunayTriangulation {
+public:
+	struct Triangle {
+		int v[3];		// 頂点のindex番号 (反時計回り)
+		int adj[3];		// v[i]の対辺で隣接する三角形 (なければ-1)
+	};
+
+private:
+	cv::Mat_<double> points;		// 頂点の座標 (最後の3行は、分割を作るときに使った外側の大きな三角形の頂点)
+	std::vector<Triangle> triangles;
+	mutable std::atomic<int> lastLocated;	// locateで直前に見つけた三角形 (次の探索の開始位置)
+
+public:
+	DelaunayTriangulation();
+	DelaunayTriangulation(const cv::Mat_<double>& X);
+	DelaunayTriangulation(const DelaunayTriangulation& other);
+	DelaunayTriangulation& operator=(const DelaunayTriangulation& other);
+
+	void build(const cv::Mat_<double>& X);
+	bool empty() const;
+	int size() const;
+	const Triangle& triangle(int index) const;
+	int locate(const double* x, double* weights) const;
+
+private:
+	void insert(int index, int& hint, std::vector<int>& stamps);
+	int walk(int start, const double* x) const;
+	double orient(int a, int b, const double* x) const;
+	bool inCircle(const Triangle& t, const double* x) const;
+};
+
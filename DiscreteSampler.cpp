@@ -0,0 +1,259 @@
+﻿#include "DiscreteSampler.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// まとめてサンプリングする際に、一度に生成する一様乱数の数
+const int SAMPLE_BLOCK = 4096;
+
+}
+
+DiscreteSampler::DiscreteSampler() : method(METHOD_ALIAS), totalWeight(0.0), positiveCount(0), updates(0) {
+}
+
+DiscreteSampler::DiscreteSampler(const vector<double>& weights, int method) {
+	build(weights, method);
+}
+
+/**
+ * 重みから分布を構築する。
+ *
+ * @param weights	各要素の重み (合計が1である必要はない。負の値は0として扱う)
+ * @param method	METHOD_CDF / METHOD_ALIAS / METHOD_FENWICK
+ */
+void DiscreteSampler::build(const vector<double>& weights, int method) {
+	this->method = method;
+	this->weights.resize(weights.size());
+	for (int i = 0; i < weights.size(); ++i) {
+		this->weights[i] = std::max(0.0, weights[i]);
+	}
+
+	rebuild();
+}
+
+bool DiscreteSampler::empty() const {
+	return weights.empty();
+}
+
+int DiscreteSampler::size() const {
+	return weights.size();
+}
+
+/**
+ * 重みの合計を返却する。
+ */
+double DiscreteSampler::total() const {
+	return totalWeight;
+}
+
+double DiscreteSampler::weight(int index) const {
+	return weights[index];
+}
+
+/**
+ * index番目の要素の重みを変更する。
+ * METHOD_FENWICKならO(log n)で更新し、METHOD_CDFは後ろの累積和を更新する (O(n))。
+ * 差分を足していくので、丸め誤差が溜まらないよう、どちらもsize()回更新するごとに再構築する。
+ * METHOD_ALIASは表全体を作り直す (O(n))。
+ *
+ * @param index		要素の番号
+ * @param weight	新しい重み (負の値は0として扱う)
+ */
+void DiscreteSampler::update(int index, double weight) {
+	weight = std::max(0.0, weight);
+	double delta = weight - weights[index];
+	positiveCount += (weight > 0.0) - (weights[index] > 0.0);
+	weights[index] = weight;
+
+	// 全ての重みが0になったら、差分の丸め誤差が残らないよう作り直す
+	if (method == METHOD_ALIAS || positiveCount == 0 || ++updates >= (int)weights.size()) {
+		rebuild();
+		return;
+	}
+
+	if (method == METHOD_FENWICK) {
+		for (int i = index + 1; i < tree.size(); i += i & -i) {
+			tree[i] += delta;
+		}
+		totalWeight += delta;
+	} else if (method == METHOD_CDF) {
+		for (int i = index; i < cdf.size(); ++i) {
+			cdf[i] += delta;
+		}
+		totalWeight = cdf.back();
+	}
+}
+
+/**
+ * 1つサンプリングし、要素の番号を返却する。重みの合計が0なら-1を返却する。
+ *
+ * @param rng		乱数 (省略時は、呼び出したスレッドのストリーム)
+ * @return			要素の番号
+ */
+int DiscreteSampler::sample(Random& rng) const {
+	if (positiveCount == 0 || totalWeight <= 0.0) return -1;
+	return find(rng.uniform());
+}
+
+/**
+ * count個サンプリングする。
+ * 一様乱数をRandom::fillUniformでまとめて生成してから、要素の番号に変換する。
+ *
+ * @param count			サンプリングする数
+ * @param indices [OUT]	要素の番号 (count個。重みの合計が0なら全て-1)
+ * @param rng			乱数 (省略時は、呼び出したスレッドのストリーム)
+ */
+void DiscreteSampler::sample(int count, int* indices, Random& rng) const {
+	if (positiveCount == 0 || totalWeight <= 0.0) {
+		std::fill(indices, indices + count, -1);
+		return;
+	}
+
+	static thread_local vector<double> u;
+	u.resize(std::min(count, SAMPLE_BLOCK));
+	for (int begin = 0; begin < count; begin += SAMPLE_BLOCK) {
+		int n = std::min(SAMPLE_BLOCK, count - begin);
+		rng.fillUniform(&u[0], n);
+		for (int i = 0; i < n; ++i) {
+			indices[begin + i] = find(u[i]);
+		}
+	}
+}
+
+vector<int> DiscreteSampler::sample(int count, Random& rng) const {
+	vector<int> indices(count);
+	if (count > 0) sample(count, &indices[0], rng);
+	return indices;
+}
+
+/**
+ * 重みから、methodに応じた構造を作り直す。
+ * METHOD_ALIASは、Voseの方法で、平均より小さい区画を平均より大きい要素で埋める。
+ */
+void DiscreteSampler::rebuild() {
+	int n = weights.size();
+	cdf.clear();
+	probability.clear();
+	alias.clear();
+	tree.clear();
+	updates = 0;
+
+	totalWeight = 0.0;
+	positiveCount = 0;
+	for (int i = 0; i < n; ++i) {
+		totalWeight += weights[i];
+		if (weights[i] > 0.0) positiveCount++;
+	}
+	if (n == 0) return;
+
+	// 重みの合計が0でも、後からupdateで重みを与えられるよう、累積和の構造は確保しておく
+	if (method == METHOD_CDF) {
+		cdf.resize(n);
+		double sum = 0.0;
+		for (int i = 0; i < n; ++i) {
+			sum += weights[i];
+			cdf[i] = sum;
+		}
+		totalWeight = sum;
+	} else if (method == METHOD_FENWICK) {
+		tree.assign(n + 1, 0.0);
+		for (int i = 1; i <= n; ++i) {
+			tree[i] += weights[i - 1];
+			int parent = i + (i & -i);
+			if (parent <= n) tree[parent] += tree[i];
+		}
+	} else {
+		if (totalWeight <= 0.0) return;
+
+		probability.resize(n);
+		alias.resize(n);
+
+		vector<double> scaled(n);
+		vector<int> small, large;
+		for (int i = 0; i < n; ++i) {
+			scaled[i] = weights[i] * n / totalWeight;
+			if (scaled[i] < 1.0) small.push_back(i);
+			else large.push_back(i);
+		}
+
+		while (!small.empty() && !large.empty()) {
+			int s = small.back();
+			small.pop_back();
+			int l = large.back();
+
+			probability[s] = scaled[s];
+			alias[s] = l;
+
+			scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+			if (scaled[l] < 1.0) {
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+
+		// 丸め誤差で残った区画は、重みが正なら確率1で自分自身を選ぶ。
+		// 重みが0の要素は選ばれてはいけないので、重みが最大の要素に譲る
+		int heaviest = std::max_element(weights.begin(), weights.end()) - weights.begin();
+		for (int k = 0; k < 2; ++k) {
+			const vector<int>& rest = k == 0 ? large : small;
+			for (int i = 0; i < rest.size(); ++i) {
+				int j = rest[i];
+				if (weights[j] > 0.0) {
+					probability[j] = 1.0;
+					alias[j] = j;
+				} else {
+					probability[j] = 0.0;
+					alias[j] = heaviest;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * [0, 1)の一様乱数uを、要素の番号に変換する。
+ * 累積和を使う方法では、累積和がu * total()を超える最初の要素を選ぶ。
+ * 更新の丸め誤差で、重みが0の要素の区間がわずかに残ることがあるので、その場合は近くの重みが正の要素を選ぶ。
+ */
+int DiscreteSampler::find(double u) const {
+	int n = weights.size();
+
+	if (method == METHOD_CDF) {
+		int i = std::upper_bound(cdf.begin(), cdf.end(), u * totalWeight) - cdf.begin();
+		return nearestPositive(std::min(i, n - 1));
+	} else if (method == METHOD_FENWICK) {
+		// 累積和がtarget以下となる最長の接頭辞を、上位のビットから決める
+		double target = u * totalWeight;
+		int pos = 0;
+		int step = 1;
+		while (step * 2 <= n) step *= 2;
+		for (; step > 0; step /= 2) {
+			if (pos + step <= n && tree[pos + step] <= target) {
+				pos += step;
+				target -= tree[pos];
+			}
+		}
+
+		return nearestPositive(std::min(pos, n - 1));
+	} else {
+		double x = u * n;
+		int i = std::min((int)x, n - 1);
+		return x - i < probability[i] ? i : alias[i];
+	}
+}
+
+/**
+ * index番目以降で最初の、重みが正の要素の番号を返却する。
+ * なければ、index番目より前で最後の、重みが正の要素の番号を返却する。
+ */
+int DiscreteSampler::nearestPositive(int index) const {
+	for (int i = index; i < weights.size(); ++i) {
+		if (weights[i] > 0.0) return i;
+	}
+	for (int i = index - 1; i >= 0; --i) {
+		if (weights[i] > 0.0) return i;
+	}
+	return index;
+}
@@ -0,0 +1,51 @@
+﻿#pragma once
+
+#include <vector>
+#include "Random.h"
+
+/**
+ * 重み付きの離散分布からのサンプリング。
+ * 分布を一度だけ構築し、同じ分布から何度もサンプリングする用途を想定する。
+ *   METHOD_CDF		累積分布を二分探索する (1回のサンプリングはO(log n))
+ *   METHOD_ALIAS	Walker/Voseのalias法 (1回のサンプリングはO(1)、重みの更新はO(n)の再構築)
+ *   METHOD_FENWICK	Fenwick treeで累積和を持つ (サンプリング、重みの更新ともにO(log n))
+ * 重みが少しずつ変わる分布にはMETHOD_FENWICK、変わらない分布にはMETHOD_ALIASが向いている。
+ * 負の重みは0として扱う。構築後のsampleはconstなので、複数のスレッドから同時に呼び出して良い
+ * (乱数はスレッドごとのストリームか、呼び出し側が渡したものを使う)。
+ */
+class DiscreteSampler {
+public:
+	enum { METHOD_CDF = 0, METHOD_ALIAS, METHOD_FENWICK };
+
+private:
+	int method;
+	std::vector<double> weights;
+	double totalWeight;
+	int positiveCount;					// 重みが正の要素の数 (0なら、totalWeightの丸め誤差に関わらずサンプリングしない)
+	std::vector<double> cdf;			// METHOD_CDF: 累積和
+	std::vector<double> probability;	// METHOD_ALIAS: 各区画で自分自身を選ぶ確率
+	std::vector<int> alias;				// METHOD_ALIAS: 各区画のもう1つの候補
+	std::vector<double> tree;			// METHOD_FENWICK: Fenwick tree (1-indexed)
+	int updates;						// METHOD_CDF / METHOD_FENWICK: 最後に構築してからの更新回数
+
+public:
+	DiscreteSampler();
+	DiscreteSampler(const std::vector<double>& weights, int method = METHOD_ALIAS);
+
+	void build(const std::vector<double>& weights, int method = METHOD_ALIAS);
+	bool empty() const;
+	int size() const;
+	double total() const;
+	double weight(int index) const;
+	void update(int index, double weight);
+
+	int sample(Random& rng = Random::local()) const;
+	void sample(int count, int* indices, Random& rng = Random::local()) const;
+	std::vector<int> sample(int count, Random& rng = Random::local()) const;
+
+private:
+	void rebuild();
+	int find(double u) const;
+	int nearestPositive(int index) const;
+};
+
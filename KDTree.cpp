@@ -0,0 +1,320 @@
+﻿#include "KDTree.h"
+#include "ThreadPool.h"
+#include "MLUtils.h"
+#include <algorithm>
+#include <limits>
+#include <cstring>
+
+using namespace std;
+
+template<typename T>
+KDTree_<T>::KDTree_() : leafSize(16) {
+}
+
+template<typename T>
+KDTree_<T>::KDTree_(const cv::Mat_<T>& X, int leafSize) {
+	build(X, leafSize);
+}
+
+/**
+ * データXからk-d treeを構築する。
+ * Xの各行が各データ。Xはコピーして保持するので、構築後にXを変更しても良い。
+ *
+ * @param X			データX
+ * @param leafSize	leafに格納する最大のデータ数
+ */
+template<typename T>
+void KDTree_<T>::build(const cv::Mat_<T>& X, int leafSize) {
+	this->leafSize = std::max(1, leafSize);
+	nodes.clear();
+
+	vector<int> perm(X.rows);
+	for (int r = 0; r < X.rows; ++r) {
+		perm[r] = r;
+	}
+	if (X.rows > 0) {
+		buildNode(0, X.rows, perm, X);
+	}
+
+	// leafの順にデータを並べ替えて、連続領域に格納する
+	data = cv::Mat_<T>(X.rows, X.cols);
+	for (int r = 0; r < X.rows; ++r) {
+		memcpy(data[r], X[perm[r]], sizeof(T) * X.cols);
+	}
+	indices = perm;
+}
+
+template<typename T>
+bool KDTree_<T>::empty() const {
+	return nodes.empty();
+}
+
+template<typename T>
+int KDTree_<T>::size() const {
+	return data.rows;
+}
+
+template<typename T>
+int KDTree_<T>::dims() const {
+	return data.cols;
+}
+
+/**
+ * perm[begin]～perm[end-1]のデータについてノードを作成し、再帰的に分割する。
+ * 最も広がりの大きい次元について、中央値で2つに分割する。
+ *
+ * @return		作成したノードのid
+ */
+template<typename T>
+int KDTree_<T>::buildNode(int begin, int end, vector<int>& perm, const cv::Mat_<T>& X) {
+	Node node;
+	node.begin = begin;
+	node.end = end;
+	node.left = -1;
+	node.right = -1;
+	node.dim = 0;
+	node.split = 0.0;
+
+	int id = nodes.size();
+	nodes.push_back(node);
+
+	if (end - begin <= leafSize) return id;
+
+	// 各次元の最小値、最大値を計算する
+	vector<T> lo(X.cols, std::numeric_limits<T>::max());
+	vector<T> hi(X.cols, -std::numeric_limits<T>::max());
+	for (int i = begin; i < end; ++i) {
+		const T* row = X[perm[i]];
+		for (int c = 0; c < X.cols; ++c) {
+			lo[c] = std::min(lo[c], row[c]);
+			hi[c] = std::max(hi[c], row[c]);
+		}
+	}
+
+	int dim = 0;
+	for (int c = 1; c < X.cols; ++c) {
+		if (hi[c] - lo[c] > hi[dim] - lo[dim]) dim = c;
+	}
+
+	// 全て同じ点なら、これ以上分割しない
+	if (hi[dim] - lo[dim] <= 0) return id;
+
+	int mid = (begin + end) / 2;
+	std::nth_element(perm.begin() + begin, perm.begin() + mid, perm.begin() + end, [&](int a, int b) {
+		return X(a, dim) < X(b, dim);
+	});
+
+	nodes[id].dim = dim;
+	nodes[id].split = X(perm[mid], dim);
+
+	int left = buildNode(begin, mid, perm, X);
+	int right = buildNode(mid, end, perm, X);
+	nodes[id].left = left;
+	nodes[id].right = right;
+
+	return id;
+}
+
+/**
+ * xのk近傍を探す。結果は距離の昇順に並ぶ。
+ * eps > 0なら近似探索となり、返却されるi番目の近傍までの距離は、真のi番目の近傍までの距離の(1+eps)倍以内となる。
+ * maxLeaves > 0なら、調べるleafの数をmaxLeaves個までに制限する (近似探索)。
+ *
+ * @param x					データx (dims()次元)
+ * @param k					近傍の数
+ * @param indices [OUT]		近傍の、元データでのindex番号
+ * @param dists [OUT]		近傍までの距離の二乗
+ * @param eps				近似の許容誤差
+ * @param maxLeaves			調べるleafの最大数 (0なら制限なし)
+ */
+template<typename T>
+void KDTree_<T>::knnSearch(const T* x, int k, vector<int>& indices, vector<T>& dists, double eps, int maxLeaves) const {
+	indices.clear();
+	dists.clear();
+	if (nodes.empty() || k <= 0) return;
+
+	static thread_local vector<T> offsets;
+	static thread_local vector<pair<T, int> > heap;
+	offsets.assign(data.cols, 0.0);
+	heap.clear();
+
+	int leaves = 0;
+	searchNode(0, x, 0.0, offsets, heap, k, (1.0 + eps) * (1.0 + eps), maxLeaves, leaves);
+
+	std::sort_heap(heap.begin(), heap.end());
+	indices.resize(heap.size());
+	dists.resize(heap.size());
+	for (int i = 0; i < (int)heap.size(); ++i) {
+		dists[i] = heap[i].first;
+		indices[i] = heap[i].second;
+	}
+}
+
+template<typename T>
+void KDTree_<T>::knnSearch(const cv::Mat_<T>& x, int k, vector<int>& indices, vector<T>& dists, double eps, int maxLeaves) const {
+	knnSearch(x[0], k, indices, dists, eps, maxLeaves);
+}
+
+/**
+ * queriesの各行について、k近傍を探す。
+ * 行を区間に分けて、スレッドプールで並列に探索する。
+ * 近傍がk個に満たない場合、残りのindexは-1、距離はTの最大値となる。
+ *
+ * @param queries			クエリ (各行が各データ)
+ * @param k					近傍の数
+ * @param indices [OUT]		近傍の、元データでのindex番号 (queries.rows x k)
+ * @param dists [OUT]		近傍までの距離の二乗 (queries.rows x k)
+ * @param eps				近似の許容誤差
+ * @param maxLeaves			調べるleafの最大数 (0なら制限なし)
+ * @param numThreads		使用するスレッド数 (0ならプールのスレッド数)
+ */
+template<typename T>
+void KDTree_<T>::knnSearch(const cv::Mat_<T>& queries, int k, cv::Mat_<int>& indices, cv::Mat_<T>& dists, double eps, int maxLeaves, int numThreads) const {
+	indices = cv::Mat_<int>(queries.rows, k, -1);
+	dists = cv::Mat_<T>(queries.rows, k, std::numeric_limits<T>::max());
+
+	ThreadPool::instance().parallelFor(0, queries.rows, [&](int begin, int end) {
+		vector<int> idx;
+		vector<T> d;
+		for (int r = begin; r < end; ++r) {
+			knnSearch(queries[r], k, idx, d, eps, maxLeaves);
+			for (int i = 0; i < (int)idx.size(); ++i) {
+				indices(r, i) = idx[i];
+				dists(r, i) = d[i];
+			}
+		}
+	}, numThreads);
+}
+
+/**
+ * xの最近傍を探す。
+ *
+ * @param x				データx (dims()次元)
+ * @param dist [OUT]	最近傍までの距離の二乗
+ * @return				最近傍の、元データでのindex番号 (データが無ければ-1)
+ */
+template<typename T>
+int KDTree_<T>::nearest(const T* x, T& dist) const {
+	dist = std::numeric_limits<T>::max();
+	if (nodes.empty()) return -1;
+
+	static thread_local vector<T> offsets;
+	static thread_local vector<pair<T, int> > heap;
+	offsets.assign(data.cols, 0.0);
+	heap.clear();
+
+	int leaves = 0;
+	searchNode(0, x, 0.0, offsets, heap, 1, 1.0, 0, leaves);
+
+	dist = heap[0].first;
+	return heap[0].second;
+}
+
+/**
+ * xから半径radius以内の点を全て探す。結果は距離順には並ばない。
+ *
+ * @param x					データx (dims()次元)
+ * @param radius			半径
+ * @param indices [OUT]		見つかった点の、元データでのindex番号
+ * @param dists [OUT]		見つかった点までの距離の二乗
+ */
+template<typename T>
+void KDTree_<T>::radiusSearch(const T* x, double radius, vector<int>& indices, vector<T>& dists) const {
+	indices.clear();
+	dists.clear();
+	if (nodes.empty()) return;
+
+	static thread_local vector<T> offsets;
+	offsets.assign(data.cols, 0.0);
+
+	radiusSearchNode(0, x, 0.0, offsets, radius * radius, indices, dists);
+}
+
+/**
+ * k近傍探索を再帰的に行う。
+ * heapには、これまでに見つかった近傍を、距離のmax heapとして格納する。
+ * rdは、xからこのノードの領域までの距離の二乗の下限、offsetsはその各次元の成分。
+ */
+template<typename T>
+void KDTree_<T>::searchNode(int node, const T* x, T rd, vector<T>& offsets, vector<pair<T, int> >& heap, int k, double epsError, int maxLeaves, int& leaves) const {
+	const Node& n = nodes[node];
+
+	if (n.left < 0) {
+		if (maxLeaves > 0 && leaves >= maxLeaves) return;
+		leaves++;
+
+		// leafのデータは連続領域に並んでいるので、まとめて距離を計算する
+		static thread_local vector<T> leafDists;
+		leafDists.resize(n.end - n.begin);
+		ml::squaredDistances(x, data[n.begin], n.end - n.begin, data.cols, &leafDists[0]);
+
+		for (int i = n.begin; i < n.end; ++i) {
+			T d = leafDists[i - n.begin];
+			if ((int)heap.size() < k) {
+				heap.push_back(make_pair(d, indices[i]));
+				std::push_heap(heap.begin(), heap.end());
+			} else if (d < heap.front().first) {
+				std::pop_heap(heap.begin(), heap.end());
+				heap.back() = make_pair(d, indices[i]);
+				std::push_heap(heap.begin(), heap.end());
+			}
+		}
+		return;
+	}
+
+	T diff = x[n.dim] - n.split;
+	int nearChild = diff < 0 ? n.left : n.right;
+	int farChild = diff < 0 ? n.right : n.left;
+
+	searchNode(nearChild, x, rd, offsets, heap, k, epsError, maxLeaves, leaves);
+
+	// 反対側の領域までの距離の下限を更新し、近傍が入り得るなら探索する
+	T old = offsets[n.dim];
+	T rd2 = rd - old * old + diff * diff;
+	if ((int)heap.size() < k || rd2 * epsError < heap.front().first) {
+		offsets[n.dim] = diff;
+		searchNode(farChild, x, rd2, offsets, heap, k, epsError, maxLeaves, leaves);
+		offsets[n.dim] = old;
+	}
+}
+
+/**
+ * 半径探索を再帰的に行う。
+ */
+template<typename T>
+void KDTree_<T>::radiusSearchNode(int node, const T* x, T rd, vector<T>& offsets, T radius2, vector<int>& indices, vector<T>& dists) const {
+	const Node& n = nodes[node];
+
+	if (n.left < 0) {
+		static thread_local vector<T> leafDists;
+		leafDists.resize(n.end - n.begin);
+		ml::squaredDistances(x, data[n.begin], n.end - n.begin, data.cols, &leafDists[0]);
+
+		for (int i = n.begin; i < n.end; ++i) {
+			T d = leafDists[i - n.begin];
+			if (d <= radius2) {
+				indices.push_back(this->indices[i]);
+				dists.push_back(d);
+			}
+		}
+		return;
+	}
+
+	T diff = x[n.dim] - n.split;
+	int nearChild = diff < 0 ? n.left : n.right;
+	int farChild = diff < 0 ? n.right : n.left;
+
+	radiusSearchNode(nearChild, x, rd, offsets, radius2, indices, dists);
+
+	T old = offsets[n.dim];
+	T rd2 = rd - old * old + diff * diff;
+	if (rd2 <= radius2) {
+		offsets[n.dim] = diff;
+		radiusSearchNode(farChild, x, rd2, offsets, radius2, indices, dists);
+		offsets[n.dim] = old;
+	}
+}
+
+template class KDTree_<double>;
+template class KDTree_<float>;
+
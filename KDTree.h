@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include <vector>
+#include <opencv/cv.h>
+
+/**
+ * k-d tree。
+ * データを一度だけ登録してtreeを構築し、k近傍探索、半径探索を行う。
+ * 距離は全てユークリッド距離の二乗で返却する。
+ * Tはデータの型 (double / float)。KDTree.cppで両方を明示的にインスタンス化する。
+ */
+template<typename T>
+class KDTree_ {
+private:
+	struct Node {
+		int begin;		// dataの開始行
+		int end;		// dataの終了行 (この行は含まない)
+		int left;		// 左の子ノード (leafなら-1)
+		int right;		// 右の子ノード (leafなら-1)
+		int dim;		// 分割する次元
+		T split;		// 分割する値
+	};
+
+	cv::Mat_<T> data;			// leafの順に並べ替えたデータ (連続領域)
+	std::vector<int> indices;	// dataの各行の、元データでのindex番号
+	std::vector<Node> nodes;
+	int leafSize;
+
+public:
+	KDTree_();
+	KDTree_(const cv::Mat_<T>& X, int leafSize = 16);
+
+	void build(const cv::Mat_<T>& X, int leafSize = 16);
+	bool empty() const;
+	int size() const;
+	int dims() const;
+
+	void knnSearch(const T* x, int k, std::vector<int>& indices, std::vector<T>& dists, double eps = 0.0, int maxLeaves = 0) const;
+	void knnSearch(const cv::Mat_<T>& x, int k, std::vector<int>& indices, std::vector<T>& dists, double eps = 0.0, int maxLeaves = 0) const;
+	void knnSearch(const cv::Mat_<T>& queries, int k, cv::Mat_<int>& indices, cv::Mat_<T>& dists, double eps = 0.0, int maxLeaves = 0, int numThreads = 0) const;
+	int nearest(const T* x, T& dist) const;
+	void radiusSearch(const T* x, double radius, std::vector<int>& indices, std::vector<T>& dists) const;
+
+private:
+	int buildNode(int begin, int end, std::vector<int>& perm, const cv::Mat_<T>& X);
+	void searchNode(int node, const T* x, T rd, std::vector<T>& offsets, std::vector<std::pair<T, int> >& heap, int k, double epsError, int maxLeaves, int& leaves) const;
+	void radiusSearchNode(int node, const T* x, T rd, std::vector<T>& offsets, T radius2, std::vector<int>& indices, std::vector<T>& dists) const;
+};
+
+typedef KDTree_<double> KDTree;
+typedef KDTree_<float> KDTreeF;
+
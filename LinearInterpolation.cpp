@@ -1,53 +1,99 @@
 ﻿#include "LinearInterpolation.h"
 #include "MLUtils.h"
+#include "ThreadPool.h"
+#include <cstring>
 
 using namespace std;
 
 /**
  * Linear interpolationを初期化する。
+ * MODE_DELAUNAYの場合、Xが2次元ならDelaunay三角形分割を1度だけ作る。
  *
  * @param X		サンプルデータの入力X
  * @param Y		サンプルデータの出力Y
  * @param alpha	どの程度の近傍点をinterpolationとしｔ使用するか (最低1。2ぐらいが適当か)
+ * @param mode	MODE_KNN (近傍点への線形回帰) / MODE_DELAUNAY (xを含む三角形の頂点の重心座標による補間)
  */
-LinearInterpolation::LinearInterpolation(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double alpha) {
+LinearInterpolation::LinearInterpolation(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double alpha, int mode) {
 	this->X = X.clone();
 	this->Y = Y.clone();
 	this->alpha = alpha;
+	this->mode = mode;
+	index.build(this->X);
+
+	if (mode == MODE_DELAUNAY && X.cols == 2) {
+		triangulation.build(this->X);
+	}
 }
 
 /**
  * Linear interpolationにより、指定されたデータxに対応するyを計算する。
+ * MODE_DELAUNAYの場合、xを含む三角形の頂点の値を重心座標で補間する。
+ * 三角形分割がない (Xが2次元でない) 場合や、xが凸包の外の場合は、近傍点への線形回帰で計算する。
  *
  * @param x		データポイント
  * @return		対応する値
  */
-cv::Mat_<double> LinearInterpolation::predict(const cv::Mat_<double>& x) {
+cv::Mat_<double> LinearInterpolation::predict(const cv::Mat_<double>& x) const {
 	// データの次元数
 	int D = X.cols;
 
-	map<double, int> lengths;
-	for (int r = 0; r < X.rows; ++r) {
-		double dist = cv::norm(X.row(r) - x);
-		lengths[dist] = r;
+	if (!triangulation.empty()) {
+		double weights[3];
+		int t = triangulation.locate(x[0], weights);
+		if (t >= 0) {
+			const DelaunayTriangulation::Triangle& tri = triangulation.triangle(t);
+			cv::Mat_<double> y(1, Y.cols);
+			for (int k = 0; k < Y.cols; ++k) {
+				y(0, k) = weights[0] * Y(tri.v[0], k) + weights[1] * Y(tri.v[1], k) + weights[2] * Y(tri.v[2], k);
+			}
+			return y;
+		}
 	}
 
 	// 使用する近傍データの数
-	int N = (D + 1) * alpha;
+	int N = std::min((int)((D + 1) * alpha), X.rows);
 
-	cv::Mat_<double> NeighborX(N, X.cols);
-	cv::Mat_<double> NeighborY(N, Y.cols);
+	// k-d treeで近傍データを探す (距離が等しいデータも、それぞれ別の近傍データとして扱う)
+	static thread_local vector<int> neighbors;
+	static thread_local vector<double> dists;
+	index.knnSearch(x[0], N, neighbors, dists);
 
-	int count = 0;
-	for (auto it = lengths.begin(); it != lengths.end() && count < N; ++it, ++count) {
-		X.row(it->second).copyTo(NeighborX.row(count));
-		Y.row(it->second).copyTo(NeighborY.row(count));
+	// 近傍データを、バイアス列を追加した形で集める (作業領域はスレッドごとに1度だけ確保して使い回す)
+	static thread_local cv::Mat_<double> neighborBufferX, neighborBufferY;
+	if (neighborBufferX.rows < N || neighborBufferX.cols != D + 1) neighborBufferX.create(N, D + 1);
+	if (neighborBufferY.rows < N || neighborBufferY.cols != Y.cols) neighborBufferY.create(N, Y.cols);
+	cv::Mat_<double> NeighborX = neighborBufferX.rowRange(0, N);
+	cv::Mat_<double> NeighborY = neighborBufferY.rowRange(0, N);
+	for (int i = 0; i < N; ++i) {
+		memcpy(NeighborX[i], X[neighbors[i]], sizeof(double) * D);
+		NeighborX(i, D) = 1.0;
+		memcpy(NeighborY[i], Y[neighbors[i]], sizeof(double) * Y.cols);
 	}
 
-	ml::addBias(NeighborX);
+	// xにバイアスを追加したコピーは作らず、係数の最終行をバイアスとして加算する
+	cv::Mat_<double> A = NeighborX.inv(cv::DECOMP_SVD) * NeighborY;
+	cv::Mat_<double> y = A.row(D).clone();
+	cv::gemm(x, A.rowRange(0, D), 1.0, y, 1.0, y);
+	return y;
+}
+
+/**
+ * Xの各行について、まとめて予測する。
+ * 行を区間に分けて、スレッドプールで並列に計算する。
+ *
+ * @param X				データX (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				予測値 (N x K)
+ */
+cv::Mat_<double> LinearInterpolation::predictBatch(const cv::Mat_<double>& X, int numThreads) const {
+	cv::Mat_<double> Y2(X.rows, Y.cols);
 
-	cv::Mat_<double> x2 = x.clone();
-	ml::addBias(x2);
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			predict(X.row(r)).copyTo(Y2.row(r));
+		}
+	}, numThreads);
 
-	return x2 * NeighborX.inv(cv::DECOMP_SVD) * NeighborY;
+	return Y2;
 }
\ No newline at end of file
@@ -2,15 +2,24 @@
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
+#include "KDTree.h"
+#include "DelaunayTriangulation.h"
 
 class LinearInterpolation {
+public:
+	enum { MODE_KNN = 0, MODE_DELAUNAY };
+
 private:
 	cv::Mat_<double> X;
 	cv::Mat_<double> Y;
 	double alpha;
+	int mode;
+	KDTree index;
+	DelaunayTriangulation triangulation;
 
 public:
-	LinearInterpolation(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double alpha);
-	cv::Mat_<double> predict(const cv::Mat_<double>& x);
+	LinearInterpolation(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double alpha, int mode = MODE_KNN);
+	cv::Mat_<double> predict(const cv::Mat_<double>& x) const;
+	cv::Mat_<double> predictBatch(const cv::Mat_<double>& X, int numThreads = 0) const;
 };
 
@@ -1,5 +1,10 @@
 ﻿#include "LinearRegression.h"
 #include "MLUtils.h"
+#include "ThreadPool.h"
+#include "NormalEquation.h"
+#include "DatasetReader.h"
+#include "ModelFile.h"
+#include <cstring>
 
 using namespace std;
 
@@ -7,23 +12,190 @@ LinearRegression::LinearRegression() {
 }
 
 
-double LinearRegression::train(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y) {
-	cv::Mat_<double> X = inputs.clone();
-	ml::addBias(X);
+/**
+ * 線形回帰の係数Wを学習する。
+ * cv::DECOMP_SVDなら、バイアス列を追加したXの擬似逆行列を使って解く。
+ * cv::DECOMP_CHOLESKY、cv::DECOMP_QRなら、X'XとX'Yを1回の走査で累積し、
+ * (D+1) x (D+1)の正規方程式を解く。条件数が悪い場合はSVDで解き直す (NormalEquation::solveを参照)。
+ *
+ * @param inputs	データX (N x D)
+ * @param Y			データY (N x K)
+ * @param method	cv::DECOMP_SVD / cv::DECOMP_CHOLESKY / cv::DECOMP_QR
+ * @return			残差
+ */
+double LinearRegression::train(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, int method) {
+	if (method == cv::DECOMP_CHOLESKY || method == cv::DECOMP_QR) {
+		NormalEquation eq;
+		eq.add(inputs, Y);
+		eq.solve(W, method);
+
+		// residueの計算 (累積値から計算するので、X * Wは不要)
+		return eq.residual(W);
+	}
+
+	// バイアス列付きの計画行列を1度だけ確保し、inputsを行ごとにコピーする (clone + addBiasの2回のコピーを避ける)
+	int D = inputs.cols;
+	cv::Mat_<double> X(inputs.rows, D + 1);
+	for (int r = 0; r < inputs.rows; ++r) {
+		memcpy(X[r], inputs[r], sizeof(double) * D);
+		X(r, D) = 1.0;
+	}
 
 	W = X.inv(cv::DECOMP_SVD) * Y;
 
-	// residueの計算
-	cv::Mat_<double> avg_mat;
-	cv::reduce((X * W - Y).mul(X * W - Y), avg_mat, 1, CV_REDUCE_SUM);
-	cv::reduce(avg_mat, avg_mat, 0, CV_REDUCE_AVG);
-	return sqrt(avg_mat(0, 0));
+	// residueの計算 (誤差行列は1つだけ確保し、その場で二乗和を取る)
+	cv::Mat_<double> error;
+	cv::gemm(X, W, 1.0, Y, -1.0, error);
+	double sum = error.dot(error);
+	return sqrt(sum / error.rows);
+}
+
+/**
+ * データセットのファイルから、chunkRows行ずつ読み込みながら、線形回帰の係数Wを学習する。
+ * X'X、X'Y、データ数を累積して正規方程式を解くので、使用するメモリはchunkRowsに比例し、
+ * ファイル全体をメモリに載せる必要はない。
+ * 結果は、同じデータをtrain(X, Y, method)で学習した場合と一致する (足し合わせる順番による丸め誤差を除く)。
+ * もしファイルがオープンできない、またはXとYの行数が異なる場合は、-1を返却する。
+ *
+ * @param filenameX		データXのファイル名 (ml::loadDatasetと同じ形式)
+ * @param filenameY		データYのファイル名 (ml::loadDatasetと同じ形式)
+ * @param binary		trueならバイナリ形式
+ * @param chunkRows		1度に読み込む行数
+ * @param method		cv::DECOMP_CHOLESKY / cv::DECOMP_QR
+ * @return				残差
+ */
+double LinearRegression::trainFromFile(const char* filenameX, const char* filenameY, bool binary, int chunkRows, int method) {
+	DatasetReader readerX, readerY;
+	if (!readerX.open(filenameX, binary) || !readerY.open(filenameY, binary)) return -1;
+
+	NormalEquation eq(readerX.cols(), readerY.cols());
+	cv::Mat_<double> bufferX, bufferY;
+	while (true) {
+		int n = readerX.read(chunkRows, bufferX);
+		int m = readerY.read(chunkRows, bufferY);
+		if (n != m || n < 0) return -1;
+		if (n == 0) break;
+
+		eq.add(bufferX.rowRange(0, n), bufferY.rowRange(0, n));
+	}
+
+	eq.solve(W, method);
+	return eq.residual(W);
 }
 
-cv::Mat LinearRegression::predict(const cv::Mat_<double>& inputs) {
-	cv::Mat_<double> X = inputs.clone();
-	ml::addBias(X);
-	return X * W;
+cv::Mat LinearRegression::predict(const cv::Mat_<double>& inputs) const {
+	return predictBatch(inputs, 1);
+}
+
+/**
+ * Xの各行について、まとめて予測する。
+ * 行を区間に分けて、スレッドプールで並列に計算する。
+ * Xにバイアス列を追加したコピーは作らず、Wの最終行をバイアスとして加算する。
+ *
+ * @param X				データX (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				予測値 (N x K)
+ */
+cv::Mat_<double> LinearRegression::predictBatch(const cv::Mat_<double>& X, int numThreads) const {
+	int D = X.cols;
+	cv::Mat_<double> Y(X.rows, W.cols);
+	cv::Mat_<double> weights = W.rowRange(0, D);
+
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		cv::Mat_<double> y = Y.rowRange(begin, end);
+		cv::gemm(X.rowRange(begin, end), weights, 1.0, cv::Mat(), 0.0, y);
+		for (int r = 0; r < y.rows; ++r) {
+			for (int c = 0; c < y.cols; ++c) {
+				y(r, c) += W(D, c);
+			}
+		}
+	}, numThreads);
+
+	return Y;
+}
+
+/**
+ * Xの各行について、単精度でまとめて予測する。
+ * 学習はdoubleで行い、推論時だけfloatにしてメモリ帯域を半分にする用途を想定する。
+ * Wは小さいので、呼び出しごとにfloatに変換する。
+ *
+ * @param X				データX (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				予測値 (N x K)
+ */
+cv::Mat_<float> LinearRegression::predictBatchFloat(const cv::Mat_<float>& X, int numThreads) const {
+	int D = X.cols;
+	cv::Mat_<float> floatW;
+	W.convertTo(floatW, CV_32F);
+	cv::Mat_<float> Y(X.rows, W.cols);
+	cv::Mat_<float> weights = floatW.rowRange(0, D);
+
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		cv::Mat_<float> y = Y.rowRange(begin, end);
+		cv::gemm(X.rowRange(begin, end), weights, 1.0, cv::Mat(), 0.0, y);
+		for (int r = 0; r < y.rows; ++r) {
+			for (int c = 0; c < y.cols; ++c) {
+				y(r, c) += floatW(D, c);
+			}
+		}
+	}, numThreads);
+
+	return Y;
+}
+
+/**
+ * 単精度で推論した場合の誤差を、倍精度の予測値に対するRMSEで返却する。
+ * floatで推論してよいかは、検証用のデータで、この値が許容範囲かを確認して判断する。
+ *
+ * @param X				検証用のデータX (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				RMSE (ml::rmse、averageColumns = false)
+ */
+double LinearRegression::floatRmse(const cv::Mat_<double>& X, int numThreads) const {
+	cv::Mat_<float> floatX;
+	X.convertTo(floatX, CV_32F);
+
+	cv::Mat_<double> floatY;
+	predictBatchFloat(floatX, numThreads).convertTo(floatY, CV_64F);
+
+	return ml::rmse(predictBatch(X, numThreads), floatY, false);
+}
+
+/**
+ * 係数WをセクションWとして追加する。
+ * 正規化の平均・標準偏差なども同じファイルに保存したい場合は、このあとfile.addで追加する。
+ *
+ * @param file		モデルファイル
+ */
+void LinearRegression::write(ModelFile& file) const {
+	file.add("W", W);
+}
+
+/**
+ * モデルファイルのセクションWから係数を読み込む。
+ *
+ * @param file		モデルファイル
+ * @return			セクションWがなければfalse
+ */
+bool LinearRegression::read(const ModelFile& file) {
+	cv::Mat_<double> w;
+	if (!file.get("W", w)) return false;
+
+	W = w.clone();
+	return true;
+}
+
+bool LinearRegression::save(const char* filename) const {
+	ModelFile file("LinearRegression");
+	write(file);
+	return file.save(filename);
+}
+
+bool LinearRegression::load(const char* filename) {
+	ModelFile file;
+	if (!file.load(filename) || file.type() != "LinearRegression") return false;
+
+	return read(file);
 }
 
 double LinearRegression::conditionNumber() {
@@ -3,6 +3,8 @@
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
+class ModelFile;
+
 class LinearRegression {
 public:
 	cv::Mat_<double> W;
@@ -10,8 +12,16 @@ public:
 public:
 	LinearRegression();
 
-	double train(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y);
-	cv::Mat predict(const cv::Mat_<double>& inputs);
+	double train(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, int method = cv::DECOMP_SVD);
+	double trainFromFile(const char* filenameX, const char* filenameY, bool binary = false, int chunkRows = 65536, int method = cv::DECOMP_CHOLESKY);
+	cv::Mat predict(const cv::Mat_<double>& inputs) const;
+	cv::Mat_<double> predictBatch(const cv::Mat_<double>& X, int numThreads = 0) const;
+	cv::Mat_<float> predictBatchFloat(const cv::Mat_<float>& X, int numThreads = 0) const;
+	double floatRmse(const cv::Mat_<double>& X, int numThreads = 0) const;
+	void write(ModelFile& file) const;
+	bool read(const ModelFile& file);
+	bool save(const char* filename) const;
+	bool load(const char* filename);
 	double conditionNumber();
 };
 
@@ -1,4 +1,7 @@
 ﻿#include "LinearRegressionRegularization.h"
+#include "ThreadPool.h"
+#include "ModelFile.h"
+#include <cstring>
 
 using namespace std;
 
@@ -6,27 +9,178 @@ LinearRegressionRegularization::LinearRegressionRegularization() {
 }
 
 
-double LinearRegressionRegularization::train(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double lambda, double alpha, int maxIter) {
-	//W = X.inv(cv::DECOMP_SVD) * Y;
-	W = cv::Mat_<double>::zeros(X.cols, Y.cols);
+/**
+ * L2正則化付きの線形回帰 (目的関数は ||XW - Y||^2 / 2N + lambda ||W||^2 / 2) の係数Wを学習する。
+ * optimizerで最適化の方法を選ぶ。
+ *   OPTIMIZER_SGD		W -= alpha * 勾配
+ *   OPTIMIZER_NESTEROV	Nesterovのmomentum (係数0.9)
+ *   OPTIMIZER_ADAM		Adam (beta1 = 0.9、beta2 = 0.999)
+ *   OPTIMIZER_RIDGE	(X'X/N + lambda I) W = X'Y/N を直接解く (alpha、maxIter等は使わない)
+ * batchSize > 0なら、各epochでデータをシャッフルし、batchSize行ずつのmini-batchで勾配を計算する。
+ * batchSize = 0なら、毎回全データで勾配を計算する (maxIter回の更新)。
+ * tol > 0なら、1 epochでのWの変化量が tol * (1 + ||W||) 以下になった時点で終了する。
+ * 各反復で使う行列は最初に確保し、反復中は再確保しない。
+ *
+ * @param X				データX (N x D)
+ * @param Y				データY (N x K)
+ * @param lambda		正則化の係数
+ * @param alpha			学習率
+ * @param maxIter		最大のepoch数
+ * @param optimizer		最適化の方法
+ * @param batchSize		mini-batchの行数 (0なら全データ)
+ * @param tol			収束判定の許容誤差 (0なら判定しない)
+ * @return				残差
+ */
+double LinearRegressionRegularization::train(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double lambda, double alpha, int maxIter, int optimizer, int batchSize, double tol) {
+	int N = X.rows;
+	int D = X.cols;
+	int K = Y.cols;
 
-	for (int iter = 0; iter < maxIter; ++iter) {
-		cv::Mat_<double> dW = X.t() * (X * W - Y) / X.rows + lambda * W;
+	if (optimizer == OPTIMIZER_RIDGE) {
+		cv::Mat_<double> A;
+		cv::mulTransposed(X, A, true, cv::Mat(), 1.0 / N);
+		for (int i = 0; i < D; ++i) {
+			A(i, i) += lambda;
+		}
+		cv::Mat_<double> B;
+		cv::gemm(X, Y, 1.0 / N, cv::Mat(), 0.0, B, cv::GEMM_1_T);
 
-		W -= dW * alpha;
+		if (!cv::solve(A, B, W, cv::DECOMP_CHOLESKY)) {
+			cv::solve(A, B, W, cv::DECOMP_SVD);
+		}
+	} else {
+		const double momentum = 0.9;
+		const double beta1 = 0.9;
+		const double beta2 = 0.999;
+		const double epsilon = 1e-8;
+
+		if (batchSize <= 0 || batchSize > N) batchSize = N;
+
+		W = cv::Mat_<double>::zeros(D, K);
+		cv::Mat_<double> G(D, K);
+		cv::Mat_<double> V = cv::Mat_<double>::zeros(D, K);
+		cv::Mat_<double> S = cv::Mat_<double>::zeros(D, K);
+		cv::Mat_<double> prevW(D, K);
+		cv::Mat_<double> R(batchSize, K);
+		cv::Mat_<double> batchX, batchY;
+		std::vector<int> perm(N);
+		for (int i = 0; i < N; ++i) perm[i] = i;
+		if (batchSize < N) {
+			batchX = cv::Mat_<double>(batchSize, D);
+			batchY = cv::Mat_<double>(batchSize, K);
+		}
+
+		int t = 0;
+		for (int iter = 0; iter < maxIter; ++iter) {
+			W.copyTo(prevW);
+			if (batchSize < N) cv::randShuffle(perm);
+
+			for (int start = 0; start < N; start += batchSize) {
+				int B = std::min(batchSize, N - start);
+				cv::Mat_<double> R2 = R.rowRange(0, B);
+
+				if (batchSize < N) {
+					for (int i = 0; i < B; ++i) {
+						memcpy(batchX[i], X[perm[start + i]], sizeof(double) * D);
+						memcpy(batchY[i], Y[perm[start + i]], sizeof(double) * K);
+					}
+					gradient(batchX.rowRange(0, B), batchY.rowRange(0, B), lambda, R2, G);
+				} else {
+					gradient(X, Y, lambda, R2, G);
+				}
+				t++;
+
+				if (optimizer == OPTIMIZER_NESTEROV) {
+					// V = momentum * V - alpha * G,  W += momentum * V - alpha * G
+					cv::addWeighted(V, momentum, G, -alpha, 0.0, V);
+					cv::scaleAdd(V, momentum, W, W);
+					cv::scaleAdd(G, -alpha, W, W);
+				} else if (optimizer == OPTIMIZER_ADAM) {
+					// Vに1次モーメント、Sに2次モーメントを累積する
+					double correction1 = 1.0 - pow(beta1, t);
+					double correction2 = 1.0 - pow(beta2, t);
+					for (int r = 0; r < D; ++r) {
+						for (int c = 0; c < K; ++c) {
+							V(r, c) = beta1 * V(r, c) + (1.0 - beta1) * G(r, c);
+							S(r, c) = beta2 * S(r, c) + (1.0 - beta2) * G(r, c) * G(r, c);
+							W(r, c) -= alpha * (V(r, c) / correction1) / (sqrt(S(r, c) / correction2) + epsilon);
+						}
+					}
+				} else {
+					cv::scaleAdd(G, -alpha, W, W);
+				}
+			}
+
+			if (tol > 0 && cv::norm(W, prevW) <= tol * (1.0 + cv::norm(W))) break;
+		}
 	}
 
 	// residueの計算
-	cv::Mat_<double> avg_mat;
-	cv::reduce((X * W - Y).mul(X * W - Y), avg_mat, 0, CV_REDUCE_AVG);
-	cv::reduce(avg_mat, avg_mat, 1, CV_REDUCE_SUM);
-	return sqrt(avg_mat(0, 0));
+	cv::Mat_<double> error;
+	cv::gemm(X, W, 1.0, Y, -1.0, error);
+	return sqrt(error.dot(error) / N);
 }
 
-cv::Mat LinearRegressionRegularization::predict(const cv::Mat_<double>& x) {
+cv::Mat LinearRegressionRegularization::predict(const cv::Mat_<double>& x) const {
 	return x * W;
 }
 
+/**
+ * Xの各行について、まとめて予測する。
+ * 行を区間に分けて、スレッドプールで並列に計算する。
+ *
+ * @param X				データX (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				予測値 (N x K)
+ */
+cv::Mat_<double> LinearRegressionRegularization::predictBatch(const cv::Mat_<double>& X, int numThreads) const {
+	cv::Mat_<double> Y(X.rows, W.cols);
+
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		cv::Mat_<double> y = Y.rowRange(begin, end);
+		cv::gemm(X.rowRange(begin, end), W, 1.0, cv::Mat(), 0.0, y);
+	}, numThreads);
+
+	return Y;
+}
+
+/**
+ * 係数WをセクションWとして追加する。
+ * 正規化の平均・標準偏差なども同じファイルに保存したい場合は、このあとfile.addで追加する。
+ *
+ * @param file		モデルファイル
+ */
+void LinearRegressionRegularization::write(ModelFile& file) const {
+	file.add("W", W);
+}
+
+/**
+ * モデルファイルのセクションWから係数を読み込む。
+ *
+ * @param file		モデルファイル
+ * @return			セクションWがなければfalse
+ */
+bool LinearRegressionRegularization::read(const ModelFile& file) {
+	cv::Mat_<double> w;
+	if (!file.get("W", w)) return false;
+
+	W = w.clone();
+	return true;
+}
+
+bool LinearRegressionRegularization::save(const char* filename) const {
+	ModelFile file("LinearRegressionRegularization");
+	write(file);
+	return file.save(filename);
+}
+
+bool LinearRegressionRegularization::load(const char* filename) {
+	ModelFile file;
+	if (!file.load(filename) || file.type() != "LinearRegressionRegularization") return false;
+
+	return read(file);
+}
+
 double LinearRegressionRegularization::conditionNumber() {
 	cv::Mat_<double> w1, w2, u, vt;
 	cv::SVD::compute(W, w1, u, vt);
@@ -36,3 +190,17 @@ double LinearRegressionRegularization::conditionNumber() {
 	return w1(0,0) * w2(0, 0);
 }
 
+/**
+ * データX、Yに対する目的関数の勾配 G = X'(XW - Y) / N + lambda W を計算する。
+ * R、Gは、確保済みの同じ大きさの行列なら再確保しない。
+ *
+ * @param X			データX (N x D)
+ * @param Y			データY (N x K)
+ * @param lambda	正則化の係数
+ * @param R [OUT]	残差 XW - Y (N x K)
+ * @param G [OUT]	勾配 (D x K)
+ */
+void LinearRegressionRegularization::gradient(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double lambda, cv::Mat_<double>& R, cv::Mat_<double>& G) const {
+	cv::gemm(X, W, 1.0, Y, -1.0, R);
+	cv::gemm(X, R, 1.0 / X.rows, W, lambda, G, cv::GEMM_1_T);
+}
@@ -3,15 +3,28 @@
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
+class ModelFile;
+
 class LinearRegressionRegularization {
+public:
+	enum { OPTIMIZER_SGD = 0, OPTIMIZER_NESTEROV, OPTIMIZER_ADAM, OPTIMIZER_RIDGE };
+
 public:
 	cv::Mat_<double> W;
 
 public:
 	LinearRegressionRegularization();
 
-	double train(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double lambda, double alpha, int maxIter);
-	cv::Mat predict(const cv::Mat_<double>& x);
+	double train(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double lambda, double alpha, int maxIter, int optimizer = OPTIMIZER_SGD, int batchSize = 0, double tol = 0.0);
+	cv::Mat predict(const cv::Mat_<double>& x) const;
+	cv::Mat_<double> predictBatch(const cv::Mat_<double>& X, int numThreads = 0) const;
+	void write(ModelFile& file) const;
+	bool read(const ModelFile& file);
+	bool save(const char* filename) const;
+	bool load(const char* filename);
 	double conditionNumber();
+
+private:
+	void gradient(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double lambda, cv::Mat_<double>& R, cv::Mat_<double>& G) const;
 };
 
@@ -1,34 +1,231 @@
 ﻿#include "LocalLinearRegression.h"
 #include "MLUtils.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
-LocalLinearRegression::LocalLinearRegression() {
+LocalLinearRegression::LocalLinearRegression() : sigma(0.0) {
 }
 
-cv::Mat_<double> LocalLinearRegression::predict(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const cv::Mat_<double>& x, double sigma) {
+/**
+ * サンプルデータを連続領域にコピーしてk-d treeを作り、以降の予測で使い回す。
+ *
+ * @param X			サンプルデータの入力 (N x D)
+ * @param Y			サンプルデータの出力 (N x K)
+ * @param sigma		カーネルの半径
+ */
+LocalLinearRegression::LocalLinearRegression(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double sigma) : sigma(sigma) {
+	this->X = X.clone();
+	this->Y = Y.clone();
+	index.build(this->X);
+}
+
+/**
+ * コンストラクタで渡したサンプルデータを使って、xでの値を予測する。
+ * 作業領域はスレッドごとに使い回すので、複数のスレッドから同時に呼び出せる。
+ *
+ * @param x			データx (1 x D)
+ * @return			予測値 (1 x K)
+ */
+cv::Mat_<double> LocalLinearRegression::predict(const cv::Mat_<double>& x) const {
+	cv::Mat_<double> y(1, Y.cols);
+	predictRow(index, X, Y, x[0], sigma, y[0]);
+	return y;
+}
+
+/**
+ * コンストラクタで渡したサンプルデータを使って、Xの各行をまとめて予測する。
+ * 行を区間に分けて、スレッドプールで並列に計算する。
+ *
+ * @param X				データX (M x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				予測値 (M x K)
+ */
+cv::Mat_<double> LocalLinearRegression::predictBatch(const cv::Mat_<double>& X, int numThreads) const {
+	cv::Mat_<double> Y2(X.rows, Y.cols);
+
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			predictRow(index, this->X, Y, X[r], sigma, Y2[r]);
+		}
+	}, numThreads);
+
+	return Y2;
+}
+
+/**
+ * xの周辺のサンプルに重みを付けた線形回帰で、xでの値を予測する。
+ * 重みは(1 - d^2/sigma^2)^2で、半径sigmaの外は0になる。
+ * 重みは行ごとのスカラー値として扱い、X'WXとX'WYを1回の走査で累積する。重みが0の行は累積しない。
+ *
+ * @param inputs	サンプルデータの入力 (N x D)
+ * @param Y			サンプルデータの出力 (N x K)
+ * @param x			データx (1 x D)
+ * @param sigma		カーネルの半径
+ * @return			予測値 (1 x K)
+ */
+cv::Mat_<double> LocalLinearRegression::predict(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const cv::Mat_<double>& x, double sigma) const {
 	int N = inputs.rows;
+	int D = inputs.cols;
+	int K = Y.cols;
+
+	cv::Mat_<double> XtWX = cv::Mat_<double>::zeros(D + 1, D + 1);
+	cv::Mat_<double> XtWY = cv::Mat_<double>::zeros(D + 1, K);
+	vector<double> z(D + 1);
 
-	// 重み行列を計算
-	cv::Mat_<double> W = cv::Mat_<double>::zeros(N, N);
 	for (int i = 0; i < N; ++i) {
-		double dot_product = (inputs.row(i) - x).dot(inputs.row(i) - x);
-		dot_product = dot_product / sigma / sigma;
-		if (dot_product > 1) dot_product = 1;
-		//W(i, i) = exp(-dot_product / 2.0 / sigma / sigma);
-		W(i, i) = (1 - dot_product) * (1 - dot_product);
+		const double* row = inputs[i];
+
+		// 重みを計算
+		double dot_product = ml::squaredDistance(row, x[0], D) / sigma / sigma;
+		if (dot_product >= 1) continue;
+		//double w = exp(-dot_product / 2.0 / sigma / sigma);
+		double w = (1 - dot_product) * (1 - dot_product);
+
+		for (int c = 0; c < D; ++c) {
+			z[c] = row[c] - x(0, c);
+		}
+
+		accumulate(&z[0], Y[i], w, XtWX, XtWY);
+	}
+
+	cv::Mat_<double> y(1, K);
+	solve(XtWX, XtWY, y[0]);
+	return y;
+}
+
+/**
+ * inputsから作ったk-d treeで半径sigma以内のサンプルだけを探し、xでの値を予測する。
+ * 重みが0になる半径の外の行は走査しないので、1回の予測のコストは近傍のサンプル数に比例する。
+ *
+ * @param index		inputsから作ったk-d tree
+ * @param inputs	サンプルデータの入力 (N x D)
+ * @param Y			サンプルデータの出力 (N x K)
+ * @param x			データx (1 x D)
+ * @param sigma		カーネルの半径
+ * @return			予測値 (1 x K)
+ */
+cv::Mat_<double> LocalLinearRegression::predict(const KDTree& index, const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const cv::Mat_<double>& x, double sigma) const {
+	cv::Mat_<double> y(1, Y.cols);
+	predictRow(index, inputs, Y, x[0], sigma, y[0]);
+	return y;
+}
+
+/**
+ * 半径sigma以内のサンプルから、xでの値を予測する。
+ * 作業領域はスレッドごとに使い回すので、同じ次元で繰り返し呼び出す場合はメモリを確保しない。
+ *
+ * @param index		inputsから作ったk-d tree
+ * @param inputs	サンプルデータの入力 (N x D)
+ * @param Y			サンプルデータの出力 (N x K)
+ * @param x			データx (D次元)
+ * @param sigma		カーネルの半径
+ * @param y [OUT]	予測値 (K次元)
+ */
+void LocalLinearRegression::predictRow(const KDTree& index, const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const double* x, double sigma, double* y) {
+	int D = inputs.cols;
+	int K = Y.cols;
+
+	static thread_local vector<int> neighbors;
+	static thread_local vector<double> dists;
+	static thread_local cv::Mat_<double> XtWX, XtWY;
+	static thread_local vector<double> z;
+	index.radiusSearch(x, sigma, neighbors, dists);
+
+	XtWX.create(D + 1, D + 1);
+	XtWY.create(D + 1, K);
+	XtWX = 0.0;
+	XtWY = 0.0;
+	z.resize(D + 1);
+
+	for (int i = 0; i < neighbors.size(); ++i) {
+		double dot_product = dists[i] / sigma / sigma;
+		if (dot_product >= 1) continue;
+		double w = (1 - dot_product) * (1 - dot_product);
+
+		const double* row = inputs[neighbors[i]];
+		for (int c = 0; c < D; ++c) {
+			z[c] = row[c] - x[c];
+		}
+
+		accumulate(&z[0], Y[neighbors[i]], w, XtWX, XtWY);
 	}
 
-	// Xを計算
-	cv::Mat_<double> X = inputs - cv::repeat(x, N, 1);
-	ml::addBias(X);
+	solve(XtWX, XtWY, y);
+}
+
+/**
+ * xからの差分にバイアス1を追加した行zについて、X'WX += w z'z、X'WY += w z'yを累積する。
+ * X'WXは上三角だけを累積する。
+ *
+ * @param z				xからの差分 (D次元、z[D]はこの関数で1にする)
+ * @param y				サンプルの出力 (K次元)
+ * @param w				重み
+ * @param XtWX [OUT]	X'WX ((D+1) x (D+1))
+ * @param XtWY [OUT]	X'WY ((D+1) x K)
+ */
+void LocalLinearRegression::accumulate(double* z, const double* y, double w, cv::Mat_<double>& XtWX, cv::Mat_<double>& XtWY) {
+	int D = XtWX.rows - 1;
+	int K = XtWY.cols;
+	z[D] = 1.0;
 
-	double det = cv::determinant((X.t() * W * X));
-	if (det == 0) {
-		cout << "Determinant = 0" << endl;
+	for (int r = 0; r <= D; ++r) {
+		double wz = w * z[r];
+		double* a = XtWX[r];
+		for (int c = r; c <= D; ++c) {
+			a[c] += wz * z[c];
+		}
+		double* b = XtWY[r];
+		for (int k = 0; k < K; ++k) {
+			b[k] += wz * y[k];
+		}
 	}
-		
-	cv::Mat_<double> alpha = (X.t() * W * X).inv(cv::DECOMP_SVD) * X.t() * W * Y;
+}
+
+/**
+ * 累積したX'WX、X'WYから係数を解き、バイアス項 (xでの予測値) をyに格納する。
+ * 近傍のサンプルが少なく退化している場合も、擬似逆行列の解を返す。
+ *
+ * @param XtWX		X'WX (上三角のみ)
+ * @param XtWY		X'WY
+ * @param y [OUT]	予測値 (K次元)
+ */
+void LocalLinearRegression::solve(cv::Mat_<double>& XtWX, const cv::Mat_<double>& XtWY, double* y) {
+	int D = XtWX.rows - 1;
+	for (int r = 1; r <= D; ++r) {
+		for (int c = 0; c < r; ++c) {
+			XtWX(r, c) = XtWX(c, r);
+		}
+	}
+
+	static thread_local cv::Mat_<double> alpha;
+	cv::solve(XtWX, XtWY, alpha, cv::DECOMP_SVD);
+
+	for (int k = 0; k < alpha.cols; ++k) {
+		y[k] = alpha(D, k);
+	}
+}
+
+/**
+ * Xの各行について、まとめて予測する。
+ * inputsのk-d treeを1度だけ作り、行を区間に分けて、スレッドプールで並列に計算する。
+ *
+ * @param inputs		サンプルデータの入力
+ * @param Y				サンプルデータの出力
+ * @param X				データX (N x D)
+ * @param sigma			カーネルの半径
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				予測値 (N x K)
+ */
+cv::Mat_<double> LocalLinearRegression::predictBatch(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const cv::Mat_<double>& X, double sigma, int numThreads) const {
+	cv::Mat_<double> Y2(X.rows, Y.cols);
+	KDTree index(inputs);
+
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			predictRow(index, inputs, Y, X[r], sigma, Y2[r]);
+		}
+	}, numThreads);
 
-	return alpha.row(alpha.rows - 1);
+	return Y2;
 }
@@ -2,10 +2,27 @@
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
+#include "KDTree.h"
 
 class LocalLinearRegression {
+private:
+	cv::Mat_<double> X;		// サンプルデータの入力 (N x D、連続領域)
+	cv::Mat_<double> Y;		// サンプルデータの出力 (N x K、連続領域)
+	double sigma;
+	KDTree index;
+
 public:
 	LocalLinearRegression();
-	cv::Mat_<double> predict(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const cv::Mat_<double>& x, double sigma);
+	LocalLinearRegression(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, double sigma);
+	cv::Mat_<double> predict(const cv::Mat_<double>& x) const;
+	cv::Mat_<double> predictBatch(const cv::Mat_<double>& X, int numThreads = 0) const;
+	cv::Mat_<double> predict(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const cv::Mat_<double>& x, double sigma) const;
+	cv::Mat_<double> predict(const KDTree& index, const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const cv::Mat_<double>& x, double sigma) const;
+	cv::Mat_<double> predictBatch(const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const cv::Mat_<double>& X, double sigma, int numThreads = 0) const;
+
+private:
+	static void predictRow(const KDTree& index, const cv::Mat_<double>& inputs, const cv::Mat_<double>& Y, const double* x, double sigma, double* y);
+	static void accumulate(double* z, const double* y, double w, cv::Mat_<double>& XtWX, cv::Mat_<double>& XtWY);
+	static void solve(cv::Mat_<double>& XtWX, const cv::Mat_<double>& XtWY, double* y);
 };
 
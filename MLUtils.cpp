@@ -1,10 +1,303 @@
 ﻿#include "MLUtils.h"
+#include "ThreadPool.h"
+#include "Random.h"
 #include <string>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <cmath>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define ML_SIMD_X86
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 namespace ml {
 
+namespace {
+
+const char DATASET_MAGIC[] = "MLDS";
+const int DATASET_VERSION = 1;
+const unsigned int DATASET_ENDIAN = 0x01020304;
+
+/**
+ * 値のバイト順を反転する。
+ */
+void swapBytes(char* p, int size) {
+	for (int i = 0; i < size / 2; ++i) {
+		std::swap(p[i], p[size - 1 - i]);
+	}
+}
+
+// 10^0 ～ 10^22 (doubleで正確に表せる10のべき乗)
+const double POW10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * [p, end)の先頭から数値を1つ読み込み、pを数値の直後まで進める。
+ * ロケールに依存せず、小数点は常に'.'とする。
+ * 有効桁数が19桁以下で、指数が小さい場合は、10のべき乗を1回掛ける (割る) だけで正確に丸めた値を求める。
+ * それ以外 (inf、nanを含む) は、classicロケールのストリームで読み込む。
+ *
+ * @param p [IN/OUT]	読み込み位置
+ * @param end			終了位置
+ * @param val [OUT]		読み込んだ値
+ * @return				数値として読めなければfalse
+ */
+bool parseDouble(const char*& p, const char* end, double& val) {
+	const char* start = p;
+
+	bool negative = false;
+	if (p < end && (*p == '+' || *p == '-')) {
+		negative = *p == '-';
+		++p;
+	}
+
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exp10 = 0;
+	bool anyDigit = false;
+	bool truncated = false;
+
+	for (; p < end && isDigit(*p); ++p) {
+		anyDigit = true;
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa > 0) digits++;
+		} else {
+			exp10++;
+			truncated = true;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (++p; p < end && isDigit(*p); ++p) {
+			anyDigit = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa > 0) digits++;
+				exp10--;
+			} else {
+				truncated = true;
+			}
+		}
+	}
+
+	if (!anyDigit) {
+		// inf、infinity、nan
+		const char* q = p;
+		while (q < end && ((*q >= 'a' && *q <= 'z') || (*q >= 'A' && *q <= 'Z'))) ++q;
+		std::string word(p, q);
+		std::transform(word.begin(), word.end(), word.begin(), ::tolower);
+		if (word == "inf" || word == "infinity") {
+			val = negative ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+		} else if (word == "nan") {
+			val = std::numeric_limits<double>::quiet_NaN();
+		} else {
+			return false;
+		}
+		p = q;
+		return true;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		++p;
+		bool expNegative = false;
+		if (p < end && (*p == '+' || *p == '-')) {
+			expNegative = *p == '-';
+			++p;
+		}
+		if (p == end || !isDigit(*p)) return false;
+
+		int e = 0;
+		for (; p < end && isDigit(*p); ++p) {
+			if (e < 10000) e = e * 10 + (*p - '0');
+		}
+		exp10 += expNegative ? -e : e;
+	}
+
+	if (!truncated && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+		val = (double)mantissa;
+		if (exp10 < 0) {
+			val /= POW10[-exp10];
+		} else {
+			val *= POW10[exp10];
+		}
+		if (negative) val = -val;
+		return true;
+	}
+
+	std::istringstream iss(std::string(start, p));
+	iss.imbue(std::locale::classic());
+	iss >> val;
+	return !iss.fail();
+}
+
+/**
+ * 1行分の文字列[begin, end)から、スペース、タブ、カンマで区切られた数値を読み込む。
+ * valuesがNULLなら、数値の数を数えるだけ。
+ *
+ * @param begin			行の開始位置
+ * @param end			行の終了位置 (改行文字を含まない)
+ * @param values [OUT]	読み込んだ数値
+ * @param maxValues		valuesに格納できる最大の数
+ * @return				数値の数 (数値として読めない部分があれば-1)
+ */
+int parseLine(const char* begin, const char* end, double* values, int maxValues) {
+	const char* p = begin;
+	int n = 0;
+
+	while (p < end && isSpace(*p)) ++p;
+	while (p < end) {
+		double val;
+		if (!parseDouble(p, end, val)) return -1;
+		if (values != NULL) {
+			if (n >= maxValues) return -1;
+			values[n] = val;
+		}
+		n++;
+
+		// 区切り文字は、空白の連続と、高々1つのカンマ
+		const char* q = p;
+		while (p < end && isSpace(*p)) ++p;
+		if (p < end && *p == ',') {
+			++p;
+			while (p < end && isSpace(*p)) ++p;
+			if (p == end) return -1;
+		} else if (p == q && p < end) {
+			return -1;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * 空白文字しかない行ならtrueを返却する。
+ */
+bool isBlankLine(const char* begin, const char* end) {
+	for (const char* p = begin; p < end; ++p) {
+		if (!isSpace(*p)) return false;
+	}
+	return true;
+}
+
+/**
+ * テキスト形式のデータセットのファイルを読み込む。
+ * ファイルをメモリにマップし、行の境界で揃えた複数の区間に分けて、スレッドプールで並列に読み込む。
+ * まず各区間の行数を数えて行列を確保し、次に各区間の値を行列の該当する行へ直接書き込む。
+ * 空行があれば、そこでデータの終わりとする。
+ * 数値として読めない行、列数が1行目と異なる行があれば、その行番号を表示してfalseを返却する。
+ */
+bool loadTextDataset(const char* filename, cv::Mat_<double>& mat) {
+	MappedFile file;
+	if (!file.open(filename)) return false;
+
+	const char* data = file.data();
+	size_t size = file.size();
+	const char* fileEnd = data + size;
+
+	// 行の境界で揃えた区間に分割する
+	int numChunks = std::max(1, std::min(ThreadPool::instance().size() * 4, (int)(size >> 16) + 1));
+	vector<const char*> bounds(numChunks + 1);
+	bounds[0] = data;
+	bounds[numChunks] = fileEnd;
+	for (int i = 1; i < numChunks; ++i) {
+		const char* p = std::max(bounds[i - 1], data + size * i / numChunks);
+		if (p > data && p[-1] != '\n') {
+			p = (const char*)memchr(p, '\n', fileEnd - p);
+			p = p == NULL ? fileEnd : p + 1;
+		}
+		bounds[i] = p;
+	}
+
+	// 各区間の行数と、最初の空行の位置を数える
+	vector<int> lineCounts(numChunks, 0);
+	vector<int> blankLines(numChunks, -1);
+	ThreadPool::instance().parallelFor(0, numChunks, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			for (const char* p = bounds[i]; p < bounds[i + 1]; ) {
+				const char* eol = (const char*)memchr(p, '\n', bounds[i + 1] - p);
+				if (eol == NULL) eol = bounds[i + 1];
+				if (isBlankLine(p, eol)) {
+					blankLines[i] = lineCounts[i];
+					break;
+				}
+				lineCounts[i]++;
+				p = eol + 1;
+			}
+		}
+	});
+
+	// 各区間が書き込む行の範囲 [firstRows[i], endRows[i])。最初の空行より後の区間は空にする
+	vector<int> firstRows(numChunks, 0);
+	vector<int> endRows(numChunks, 0);
+	int rows = 0;
+	bool terminated = false;
+	for (int i = 0; i < numChunks; ++i) {
+		firstRows[i] = rows;
+		if (!terminated) {
+			if (blankLines[i] >= 0) {
+				rows += blankLines[i];
+				terminated = true;
+			} else {
+				rows += lineCounts[i];
+			}
+		}
+		endRows[i] = rows;
+	}
+	if (rows == 0) return false;
+
+	// 1行目から列数を決める
+	const char* eol = (const char*)memchr(data, '\n', size);
+	int cols = parseLine(data, eol == NULL ? fileEnd : eol, NULL, 0);
+	if (cols <= 0) {
+		cerr << filename << ": line 1: malformed data" << endl;
+		return false;
+	}
+
+	// 各区間の値を、行列の該当する行へ直接書き込む
+	mat = cv::Mat_<double>(rows, cols);
+	std::mutex mutex;
+	int errorLine = std::numeric_limits<int>::max();
+	ThreadPool::instance().parallelFor(0, numChunks, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			int r = firstRows[i];
+			for (const char* p = bounds[i]; p < bounds[i + 1] && r < endRows[i]; ++r) {
+				const char* eol = (const char*)memchr(p, '\n', bounds[i + 1] - p);
+				if (eol == NULL) eol = bounds[i + 1];
+				if (parseLine(p, eol, mat[r], cols) != cols) {
+					std::lock_guard<std::mutex> lock(mutex);
+					errorLine = std::min(errorLine, r + 1);
+					break;
+				}
+				p = eol + 1;
+			}
+		}
+	});
+
+	if (errorLine < std::numeric_limits<int>::max()) {
+		cerr << filename << ": line " << errorLine << ": malformed data" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+}
+
 
 vector<string> splitDataset(const string &str, char sep) {
     vector<string> v;
@@ -16,6 +309,29 @@ vector<string> splitDataset(const string &str, char sep) {
     return v;
 }
 
+/**
+ * データセットのファイルの1行を、スペース、タブ、カンマ区切りの数値として読み込む。
+ * 数値はdoubleの精度で、ロケールに依存せずに読み込む。
+ *
+ * @param str			1行の文字列
+ * @param rec [OUT]		数値の列
+ * @return				数値として読めない部分があればfalse
+ */
+bool parseDatasetLine(const string& str, vector<double>& rec) {
+	const char* begin = str.c_str();
+	const char* end = begin + str.size();
+
+	int n = parseLine(begin, end, NULL, 0);
+	if (n < 0) {
+		rec.clear();
+		return false;
+	}
+
+	rec.resize(n);
+	if (n > 0) parseLine(begin, end, &rec[0], n);
+	return true;
+}
+
 /**
  * データを、指定された比率に従い、2つのデータに分割する。
  *
@@ -24,16 +340,8 @@ void splitDataset(const cv::Mat_<double>& data, float ratio1, cv::Mat_<double>&
 	int rows1 = data.rows * ratio1;
 	int rows2 = data.rows - rows1;
 
-	data1 = cv::Mat_<double>(rows1, data.cols);
-	data2 = cv::Mat_<double>(rows2, data.cols);
-
-	for (int r = 0; r < data.rows; ++r) {
-		if (r < rows1) {
-			data.row(r).copyTo(data1.row(r));
-		} else {
-			data.row(r).copyTo(data2.row(r - rows1));
-		}
-	}
+	data1 = data.rowRange(0, rows1).clone();
+	data2 = data.rowRange(rows1, rows1 + rows2).clone();
 }
 
 void splitDataset(const cv::Mat_<double>& data, float ratio1, float ratio2, cv::Mat_<double>& data1, cv::Mat_<double>& data2, cv::Mat_<double>& data3) {
@@ -41,21 +349,9 @@ void splitDataset(const cv::Mat_<double>& data, float ratio1, float ratio2, cv::
 	int rows2 = data.rows * ratio2;
 	int rows3 = data.rows - rows1 - rows2;
 
-	data1 = cv::Mat_<double>(rows1, data.cols);
-	data2 = cv::Mat_<double>(rows2, data.cols);
-	data3 = cv::Mat_<double>(rows3, data.cols);
-
-	for (int r = 0; r < data.rows; ++r) {
-		for (int c = 0; c < data.cols; ++c) {
-			if (r < rows1) {
-				data1(r, c) = data(r, c);
-			} else if (r < rows1 + rows2) {
-				data2(r - rows1, c) = data(r, c);
-			} else {
-				data3(r - rows1 - rows2, c) = data(r, c);
-			}
-		}
-	}
+	data1 = data.rowRange(0, rows1).clone();
+	data2 = data.rowRange(rows1, rows1 + rows2).clone();
+	data3 = data.rowRange(rows1 + rows2, rows1 + rows2 + rows3).clone();
 }
 
 /**
@@ -71,23 +367,35 @@ void splitDataset(const cv::Mat_<double>& data, float ratio1, float ratio2, cv::
  * @param data 行列
  */
 void shuffle(cv::Mat_<double>& data) {
-	cv::Mat_<double> tmp = data.clone();
-
 	std::vector<int> seeds;
-	for (int i = 0; i < tmp.rows; ++i)
+	for (int i = 0; i < data.rows; ++i)
 		seeds.push_back(i);
 
 	cv::randShuffle(seeds);
 
-	for (int i = 0; i < tmp.rows; ++i)
-		tmp.row(seeds[i]).copyTo(data.row(i));
+	// i行目をseeds[i]行目で置き換える。置換の巡回ごとに1行だけ退避し、行列全体のコピーは作らない
+	std::vector<double> row(data.cols);
+	std::vector<char> done(data.rows, 0);
+	size_t bytes = sizeof(double) * data.cols;
+	for (int i = 0; i < data.rows; ++i) {
+		if (done[i]) continue;
+
+		if (bytes > 0) memcpy(&row[0], data[i], bytes);
+		int j = i;
+		while (seeds[j] != i) {
+			if (bytes > 0) memcpy(data[j], data[seeds[j]], bytes);
+			done[j] = 1;
+			j = seeds[j];
+		}
+		if (bytes > 0) memcpy(data[j], &row[0], bytes);
+		done[j] = 1;
+	}
 }
 
 /**
  * ファイルからデータを読み込む。
- * ファイルの各行は、[x1, x2, ...],[y1, y2, ...] のフォーマットになっていること。
- * [x1, x2, ...]は、行列Xへ格納され、[y1, y2, ...]は、行列Yへ格納される。
- * もしファイルがオープンできない場合は、falseを返却する。
+ * テキスト形式では、ファイルの各行が行列の各行となり、値はスペース、タブ、またはカンマで区切る。
+ * もしファイルがオープンできない場合、または数値として読めない行がある場合は、falseを返却する。
  * 
  */
 bool loadDataset(char* filename, cv::Mat_<double>& mat, bool binary) {
@@ -97,45 +405,18 @@ bool loadDataset(char* filename, cv::Mat_<double>& mat, bool binary) {
 			return false;
 		}
 
-		int rows, cols;
-		ifs.read((char*)&rows, sizeof(int));
-		ifs.read((char*)&cols, sizeof(int));
-
-		mat = cv::Mat_<double>(rows, cols);
-		for (int r = 0; r < rows; ++r) {
-			for (int c = 0; c < cols; ++c) {
-				ifs.read((char*)&mat(r, c), sizeof(double));
-			}
-		}
-		ifs.close();
-	} else {
-		std::ifstream ifs(filename);
-		if (ifs.fail()) {
+		DatasetHeader header;
+		if (!readDatasetHeader(ifs, header)) {
 			return false;
 		}
 
-		vector<vector<double> > vec;
-
-		std::string str;
-		while (getline(ifs, str)) {
-			if (str == "") break;
-
-			vector<double> rec;
-			vector<string> list = ml::splitDataset(str, ' ');
-			for (int i = 0; i < list.size(); ++i) {
-				rec.push_back(stof(list[i]));
-			}
-			vec.push_back(rec);
-		}
-
-		mat = cv::Mat_<double>(vec.size(), vec[0].size());
-
-		for (int r = 0; r < vec.size(); ++r) {
-			for (int c = 0; c < vec[r].size(); ++c) {
-				mat(r, c) = vec[r][c];
-			}
+		mat = cv::Mat_<double>(header.rows, header.cols);
+		if (!readDatasetValues(ifs, header, (double*)mat.data, header.rows * header.cols)) {
+			return false;
 		}
 		ifs.close();
+	} else {
+		return loadTextDataset(filename, mat);
 	}
 
 	return true;
@@ -147,18 +428,24 @@ void saveDataset(char* filename, const cv::Mat_<double>& mat, bool binary) {
 	if (binary) {
 		ofstream ofs(filename, ios::binary);
 
-		int rows = mat.rows;
-		int cols = mat.cols;
-		ofs.write((char*)&rows, sizeof(int));
-		ofs.write((char*)&cols, sizeof(int));
+		DatasetHeader header;
+		memset(&header, 0, sizeof(DatasetHeader));
+		memcpy(header.magic, DATASET_MAGIC, 4);
+		header.version = DATASET_VERSION;
+		header.endian = DATASET_ENDIAN;
+		header.dtype = CV_64F;
+		header.rows = mat.rows;
+		header.cols = mat.cols;
+		header.dataOffset = sizeof(DatasetHeader);
+		ofs.write((char*)&header, sizeof(DatasetHeader));
+
 		for (int iter = 0; iter < mat.rows; ++iter) {
-			for (int c = 0; c < mat.cols; ++c) {
-				ofs.write((char*)&mat(iter, c), sizeof(double));
-			}
+			ofs.write((char*)mat[iter], sizeof(double) * mat.cols);
 		}
 		ofs.close();
 	} else {
 		ofstream ofs(filename);
+		ofs.precision(std::numeric_limits<double>::max_digits10);
 
 		for (int iter = 0; iter < N; ++iter) {
 			for (int c = 0; c < mat.cols; ++c) {
@@ -171,10 +458,136 @@ void saveDataset(char* filename, const cv::Mat_<double>& mat, bool binary) {
 	}
 }
 
+/**
+ * バイナリ形式のデータセットのヘッダを読み込み、値の先頭まで読み進める。
+ * 旧形式 (行数、列数のint2つの後に、doubleの値が並ぶ) のファイルも読み込める。その場合、versionは0となる。
+ * もしヘッダが壊れている、または対応していない形式の場合は、falseを返却する。
+ *
+ * @param is				入力ストリーム (バイナリモード)
+ * @param header [OUT]		ヘッダ
+ */
+bool readDatasetHeader(std::istream& is, DatasetHeader& header) {
+	memset(&header, 0, sizeof(DatasetHeader));
+	is.read((char*)&header, 8);
+	if (is.fail()) return false;
+
+	if (memcmp(header.magic, DATASET_MAGIC, 4) != 0) {
+		// 旧形式
+		int rows, cols;
+		memcpy(&rows, (char*)&header, sizeof(int));
+		memcpy(&cols, (char*)&header + sizeof(int), sizeof(int));
+
+		memset(&header, 0, sizeof(DatasetHeader));
+		header.version = 0;
+		header.endian = DATASET_ENDIAN;
+		header.dtype = CV_64F;
+		header.rows = rows;
+		header.cols = cols;
+		header.dataOffset = 2 * sizeof(int);
+		return rows >= 0 && cols >= 0;
+	}
+
+	is.read((char*)&header + 8, sizeof(DatasetHeader) - 8);
+	if (is.fail()) return false;
+
+	// endianは、このマシンと同じ値か、そのバイト順を逆にした値のみ受け付ける
+	if (header.endian != DATASET_ENDIAN) {
+		unsigned int endian = header.endian;
+		swapBytes((char*)&endian, sizeof(unsigned int));
+		if (endian != DATASET_ENDIAN) return false;
+
+		swapBytes((char*)&header.version, sizeof(int));
+		swapBytes((char*)&header.rows, sizeof(long long));
+		swapBytes((char*)&header.cols, sizeof(long long));
+		swapBytes((char*)&header.dataOffset, sizeof(long long));
+		swapBytes((char*)&header.dtype, sizeof(int));
+	}
+	if (header.version > DATASET_VERSION) return false;
+	if (header.dtype != CV_64F && header.dtype != CV_32F) return false;
+
+	is.seekg(header.dataOffset, ios::beg);
+	return !is.fail();
+}
+
+/**
+ * バイナリ形式のデータセットから、count個の値を読み込み、doubleとしてvaluesに格納する。
+ * ヘッダのdtype、エンディアンに従って変換する。
+ *
+ * @param is				入力ストリーム (バイナリモード)
+ * @param header			ヘッダ
+ * @param values [OUT]		読み込んだ値
+ * @param count				値の数
+ */
+bool readDatasetValues(std::istream& is, const DatasetHeader& header, double* values, long long count) {
+	bool swap = header.endian != DATASET_ENDIAN;
+
+	if (header.dtype == CV_64F) {
+		is.read((char*)values, sizeof(double) * count);
+		if (swap) {
+			for (long long i = 0; i < count; ++i) {
+				swapBytes((char*)&values[i], sizeof(double));
+			}
+		}
+	} else {
+		// floatの値を、valuesの後半に読み込んでから、前から順にdoubleへ変換する
+		float* tmp = (float*)values + count;
+		is.read((char*)tmp, sizeof(float) * count);
+		for (long long i = 0; i < count; ++i) {
+			if (swap) swapBytes((char*)&tmp[i], sizeof(float));
+			values[i] = tmp[i];
+		}
+	}
+
+	return !is.fail();
+}
+
+/**
+ * バイナリ形式のデータセットのファイルをメモリにマップし、コピーせずに行列として参照する。
+ * matはfileがマップした領域を直接指すので、fileをcloseするまでの間だけ有効で、書き換えてはいけない。
+ * 現在のバージョンの形式で、doubleの値が、このマシンと同じエンディアンで書かれたファイルのみ対応する。
+ * それ以外の場合は、falseを返却する (loadDatasetなら読み込める)。
+ *
+ * @param filename		ファイル名
+ * @param file [OUT]	マップしたファイル
+ * @param mat [OUT]		ファイル内の値を指す行列
+ */
+bool mapDataset(const char* filename, MappedFile& file, cv::Mat_<double>& mat) {
+	if (!file.open(filename)) return false;
+
+	DatasetHeader header;
+	if (file.size() < sizeof(DatasetHeader)) {
+		file.close();
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(DatasetHeader));
+
+	if (memcmp(header.magic, DATASET_MAGIC, 4) != 0 || header.version != DATASET_VERSION || header.endian != DATASET_ENDIAN || header.dtype != CV_64F
+		|| header.dataOffset % sizeof(double) != 0 || header.dataOffset + sizeof(double) * header.rows * header.cols > file.size()) {
+		file.close();
+		return false;
+	}
+
+	mat = cv::Mat_<double>(header.rows, header.cols, (double*)(file.data() + header.dataOffset));
+	return true;
+}
+
+/**
+ * 列ごとに平均0、標準偏差1となるよう正規化する。
+ * 統計量は1回の走査で計算し、正規化はrepeatした行列を作らずに行う。
+ * normalized_matにmatと同じ行列を渡した場合は、その場で正規化する。
+ *
+ * @param mat					データ
+ * @param normalized_mat [OUT]	正規化したデータ
+ * @param mean [OUT]			各列の平均 (1 x D)
+ * @param stddev [OUT]			各列の標準偏差 (1 x D)
+ */
 void normalizeDataset(cv::Mat_<double> mat, cv::Mat_<double>& normalized_mat, cv::Mat_<double>& mean, cv::Mat_<double>& stddev) {
 	ml::meanStdDev(mat, mean, stddev);
 
-	normalized_mat = (mat - cv::repeat(mean, mat.rows, 1)) / cv::repeat(stddev, mat.rows, 1);
+	if (normalized_mat.data != mat.data) {
+		normalized_mat = mat.clone();
+	}
+	normalize(normalized_mat, mean, stddev);
 	/*
 	// 中央値を計算
 	cv::Mat_<double> max_mat, min_mat;
@@ -201,24 +614,183 @@ void normalizeDataset(cv::Mat_<double> mat, cv::Mat_<double>& normalized_mat, cv
 	*/
 }
 
+/**
+ * 列ごとに最小値0、最大値1となるよう正規化する。
+ * 最小値と最大値は1回の走査で計算し、正規化はrepeatした行列を作らずに行う。
+ * normalized_matにmatと同じ行列を渡した場合は、その場で正規化する。
+ *
+ * @param mat					データ
+ * @param normalized_mat [OUT]	正規化したデータ
+ * @param minimum [OUT]			各列の最小値 (1 x D)
+ * @param maximum [OUT]			各列の値の範囲 (最大値 - 最小値、1 x D)
+ */
 void normalizeDataset2(cv::Mat_<double> mat, cv::Mat_<double>& normalized_mat, cv::Mat_<double>& minimum, cv::Mat_<double>& maximum) {
-	cv::reduce(mat, minimum, 0, CV_REDUCE_MIN);
-	normalized_mat = mat - cv::repeat(minimum, mat.rows, 1);
+	columnMinMax(mat, minimum, maximum);
+
+	for (int c = 0; c < mat.cols; ++c) {
+		maximum(0, c) -= minimum(0, c);
+	}
+
+	if (normalized_mat.data != mat.data) {
+		normalized_mat = mat.clone();
+	}
+	normalize(normalized_mat, minimum, maximum);
+}
+
+/**
+ * 列ごとの最小値と最大値を、行優先で1回だけ走査して計算する。
+ * 行を区間に分けて、スレッドプールで並列に計算する。
+ *
+ * @param src				データ (N x D)
+ * @param minimum [OUT]		各列の最小値 (1 x D)
+ * @param maximum [OUT]		各列の最大値 (1 x D)
+ * @param numThreads		使用するスレッド数 (0ならプールのスレッド数)
+ */
+void columnMinMax(const cv::Mat_<double>& src, cv::Mat_<double>& minimum, cv::Mat_<double>& maximum, int numThreads) {
+	minimum = cv::Mat_<double>(1, src.cols, std::numeric_limits<double>::max());
+	maximum = cv::Mat_<double>(1, src.cols, -std::numeric_limits<double>::max());
+
+	mutex m;
+	ThreadPool::instance().parallelFor(0, src.rows, [&](int begin, int end) {
+		vector<double> lo(src.cols, std::numeric_limits<double>::max());
+		vector<double> hi(src.cols, -std::numeric_limits<double>::max());
+		for (int r = begin; r < end; ++r) {
+			const double* row = src[r];
+			for (int c = 0; c < src.cols; ++c) {
+				lo[c] = std::min(lo[c], row[c]);
+				hi[c] = std::max(hi[c], row[c]);
+			}
+		}
+
+		lock_guard<mutex> lock(m);
+		for (int c = 0; c < src.cols; ++c) {
+			minimum(0, c) = std::min(minimum(0, c), lo[c]);
+			maximum(0, c) = std::max(maximum(0, c), hi[c]);
+		}
+	}, numThreads);
+}
+
+/**
+ * 列ごとのデータ数、平均、平均からの偏差の二乗和を、行優先で1回だけ走査して計算する。
+ * 行を区間に分けて、区間ごとにWelford法で累積し、区間の順に結合する (スレッドの実行順によらず、同じ結果になる)。
+ *
+ * @param src				データ (N x D)
+ * @param moments [OUT]		累積値
+ * @param numThreads		使用するスレッド数 (0ならプールのスレッド数)
+ */
+void columnMoments(const cv::Mat_<double>& src, ColumnMoments& moments, int numThreads) {
+	moments.count = 0;
+	moments.mean.assign(src.cols, 0.0);
+	moments.m2.assign(src.cols, 0.0);
+
+	mutex m;
+	vector<pair<int, ColumnMoments> > partials;
+	ThreadPool::instance().parallelFor(0, src.rows, [&](int begin, int end) {
+		ColumnMoments partial;
+		partial.count = 0;
+		partial.mean.assign(src.cols, 0.0);
+		partial.m2.assign(src.cols, 0.0);
+
+		for (int r = begin; r < end; ++r) {
+			const double* row = src[r];
+			partial.count++;
+			double inv = 1.0 / partial.count;
+			for (int c = 0; c < src.cols; ++c) {
+				double delta = row[c] - partial.mean[c];
+				partial.mean[c] += delta * inv;
+				partial.m2[c] += delta * (row[c] - partial.mean[c]);
+			}
+		}
+
+		lock_guard<mutex> lock(m);
+		partials.push_back(make_pair(begin, partial));
+	}, numThreads);
+
+	std::sort(partials.begin(), partials.end(), [](const pair<int, ColumnMoments>& a, const pair<int, ColumnMoments>& b) {
+		return a.first < b.first;
+	});
+	for (int i = 0; i < partials.size(); ++i) {
+		mergeMoments(moments, partials[i].second);
+	}
+}
 
-	cv::reduce(normalized_mat, maximum, 0, CV_REDUCE_MAX);
-	normalized_mat /= cv::repeat(maximum, mat.rows, 1);
+/**
+ * 別のデータから計算した累積値otherを、momentsに結合する (Chanらの方法)。
+ *
+ * @param moments [IN/OUT]	累積値
+ * @param other				結合する累積値
+ */
+void mergeMoments(ColumnMoments& moments, const ColumnMoments& other) {
+	if (other.count == 0) return;
+	if (moments.count == 0) {
+		moments = other;
+		return;
+	}
+
+	double n = moments.count + other.count;
+	double wb = other.count / n;
+	for (int c = 0; c < moments.mean.size(); ++c) {
+		double delta = other.mean[c] - moments.mean[c];
+		moments.mean[c] += delta * wb;
+		moments.m2[c] += other.m2[c] + delta * delta * moments.count * wb;
+	}
+	moments.count += other.count;
+}
+
+/**
+ * 各列から平均 (オフセット) を引き、標準偏差 (スケール) で割る。一時的な行列は作らず、その場で更新する。
+ *
+ * @param mat [IN/OUT]		データ (N x D)
+ * @param mean				各列のオフセット (1 x D)
+ * @param stddev			各列のスケール (1 x D)
+ * @param numThreads		使用するスレッド数 (0ならプールのスレッド数)
+ */
+void normalize(cv::Mat_<double>& mat, const cv::Mat_<double>& mean, const cv::Mat_<double>& stddev, int numThreads) {
+	const double* mu = mean[0];
+	const double* sigma = stddev[0];
+
+	ThreadPool::instance().parallelFor(0, mat.rows, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			double* row = mat[r];
+			for (int c = 0; c < mat.cols; ++c) {
+				row[c] = (row[c] - mu[c]) / sigma[c];
+			}
+		}
+	}, numThreads);
 }
 
+/**
+ * normalizeの逆変換。各列に標準偏差 (スケール) を掛け、平均 (オフセット) を足す。その場で更新する。
+ *
+ * @param mat [IN/OUT]		データ (N x D)
+ * @param mean				各列のオフセット (1 x D)
+ * @param stddev			各列のスケール (1 x D)
+ * @param numThreads		使用するスレッド数 (0ならプールのスレッド数)
+ */
+void denormalize(cv::Mat_<double>& mat, const cv::Mat_<double>& mean, const cv::Mat_<double>& stddev, int numThreads) {
+	const double* mu = mean[0];
+	const double* sigma = stddev[0];
+
+	ThreadPool::instance().parallelFor(0, mat.rows, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			double* row = mat[r];
+			for (int c = 0; c < mat.cols; ++c) {
+				row[c] = row[c] * sigma[c] + mu[c];
+			}
+		}
+	}, numThreads);
+}
 
 /**
  * 一番右の列に1を追加する。
+ * 1列広い行列を1度だけ確保して元のデータをコピーし、右端の列を1で埋める (元のデータのcloneは作らない)。
+ * 学習で使う場合は、addBiasせずに、最初からバイアス列付きで行列を確保して埋める方が良い。
  */
 void addBias(cv::Mat& data) {
-	cv::Mat tmp = data.clone();
-	data = cv::Mat::ones(tmp.rows, tmp.cols + 1, data.type());
-
-	cv::Mat roi(data, cv::Rect(0, 0, tmp.cols, tmp.rows));
-	tmp.copyTo(roi);
+	cv::Mat biased(data.rows, data.cols + 1, data.type());
+	data.copyTo(biased.colRange(0, data.cols));
+	biased.col(data.cols).setTo(1.0);
+	data = biased;
 }
 
 /**
@@ -242,6 +814,561 @@ void quadratic_dataset(const cv::Mat_<double>& data, cv::Mat_<double>& data2) {
 	}
 }
 
+namespace {
+
+// 要素数がこれ以上の行列は、スレッドプールで並列に処理する
+const int ELEMENTWISE_PARALLEL_SIZE = 1 << 16;
+
+/**
+ * 要素ごとの演算のカーネル。Tは要素の型 (uchar / float / double)。
+ * CPUが対応する命令セットに応じて、実行時に1つを選ぶ。
+ * 各カーネルは、連続したn個の要素を処理する。
+ */
+template<typename T>
+struct ElementwiseKernels {
+	void (*min)(const T* a, const T* b, T* dst, int n);
+	void (*max)(const T* a, const T* b, T* dst, int n);
+	void (*clamp)(T* p, int n, T lo, T hi);
+	void (*threshold)(const T* src, T* dst, int n, T th);
+};
+
+/**
+ * 比較は元の実装と同じく、b < aの場合だけbを採用する (NaNの場合はaのまま)。
+ */
+template<typename T>
+void minSpanScalar(const T* a, const T* b, T* dst, int n) {
+	for (int i = 0; i < n; ++i) {
+		dst[i] = b[i] < a[i] ? b[i] : a[i];
+	}
+}
+
+template<typename T>
+void maxSpanScalar(const T* a, const T* b, T* dst, int n) {
+	for (int i = 0; i < n; ++i) {
+		dst[i] = b[i] > a[i] ? b[i] : a[i];
+	}
+}
+
+template<typename T>
+void clampSpanScalar(T* p, int n, T lo, T hi) {
+	for (int i = 0; i < n; ++i) {
+		T v = lo > p[i] ? lo : p[i];
+		p[i] = hi < v ? hi : v;
+	}
+}
+
+template<typename T>
+void thresholdSpanScalar(const T* src, T* dst, int n, T th) {
+	for (int i = 0; i < n; ++i) {
+		dst[i] = src[i] > th ? 1 : 0;
+	}
+}
+
+#ifdef ML_SIMD_X86
+
+/**
+ * AVX2の演算を、要素の型ごとに特殊化する。
+ * min(a, b)はa < b ? a : b、max(a, b)はa > b ? a : b、step(v, th)はv > th ? 1 : 0。
+ */
+template<typename T>
+struct Avx2Ops;
+
+template<>
+struct Avx2Ops<double> {
+	typedef __m256d V;
+	enum { WIDTH = 4 };
+	__attribute__((target("avx2"))) static V load(const double* p) { return _mm256_loadu_pd(p); }
+	__attribute__((target("avx2"))) static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+	__attribute__((target("avx2"))) static V set1(double v) { return _mm256_set1_pd(v); }
+	__attribute__((target("avx2"))) static V min(V a, V b) { return _mm256_min_pd(a, b); }
+	__attribute__((target("avx2"))) static V max(V a, V b) { return _mm256_max_pd(a, b); }
+	__attribute__((target("avx2"))) static V step(V v, V th) { return _mm256_and_pd(_mm256_cmp_pd(v, th, _CMP_GT_OQ), _mm256_set1_pd(1.0)); }
+};
+
+template<>
+struct Avx2Ops<float> {
+	typedef __m256 V;
+	enum { WIDTH = 8 };
+	__attribute__((target("avx2"))) static V load(const float* p) { return _mm256_loadu_ps(p); }
+	__attribute__((target("avx2"))) static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+	__attribute__((target("avx2"))) static V set1(float v) { return _mm256_set1_ps(v); }
+	__attribute__((target("avx2"))) static V min(V a, V b) { return _mm256_min_ps(a, b); }
+	__attribute__((target("avx2"))) static V max(V a, V b) { return _mm256_max_ps(a, b); }
+	__attribute__((target("avx2"))) static V step(V v, V th) { return _mm256_and_ps(_mm256_cmp_ps(v, th, _CMP_GT_OQ), _mm256_set1_ps(1.0f)); }
+};
+
+template<>
+struct Avx2Ops<uchar> {
+	typedef __m256i V;
+	enum { WIDTH = 32 };
+	__attribute__((target("avx2"))) static V load(const uchar* p) { return _mm256_loadu_si256((const __m256i*)p); }
+	__attribute__((target("avx2"))) static void store(uchar* p, V v) { _mm256_storeu_si256((__m256i*)p, v); }
+	__attribute__((target("avx2"))) static V set1(uchar v) { return _mm256_set1_epi8((char)v); }
+	__attribute__((target("avx2"))) static V min(V a, V b) { return _mm256_min_epu8(a, b); }
+	__attribute__((target("avx2"))) static V max(V a, V b) { return _mm256_max_epu8(a, b); }
+	// 飽和減算v - thは、v > thの場合だけ正になる
+	__attribute__((target("avx2"))) static V step(V v, V th) { return _mm256_min_epu8(_mm256_subs_epu8(v, th), _mm256_set1_epi8(1)); }
+};
+
+template<typename T>
+__attribute__((target("avx2")))
+void minSpanAvx2(const T* a, const T* b, T* dst, int n) {
+	typedef Avx2Ops<T> Ops;
+	int i = 0;
+	for (; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+		Ops::store(dst + i, Ops::min(Ops::load(b + i), Ops::load(a + i)));
+	}
+	minSpanScalar(a + i, b + i, dst + i, n - i);
+}
+
+template<typename T>
+__attribute__((target("avx2")))
+void maxSpanAvx2(const T* a, const T* b, T* dst, int n) {
+	typedef Avx2Ops<T> Ops;
+	int i = 0;
+	for (; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+		Ops::store(dst + i, Ops::max(Ops::load(b + i), Ops::load(a + i)));
+	}
+	maxSpanScalar(a + i, b + i, dst + i, n - i);
+}
+
+template<typename T>
+__attribute__((target("avx2")))
+void clampSpanAvx2(T* p, int n, T lo, T hi) {
+	typedef Avx2Ops<T> Ops;
+	typename Ops::V vlo = Ops::set1(lo);
+	typename Ops::V vhi = Ops::set1(hi);
+	int i = 0;
+	for (; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+		Ops::store(p + i, Ops::min(vhi, Ops::max(vlo, Ops::load(p + i))));
+	}
+	clampSpanScalar(p + i, n - i, lo, hi);
+}
+
+template<typename T>
+__attribute__((target("avx2")))
+void thresholdSpanAvx2(const T* src, T* dst, int n, T th) {
+	typedef Avx2Ops<T> Ops;
+	typename Ops::V vth = Ops::set1(th);
+	int i = 0;
+	for (; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+		Ops::store(dst + i, Ops::step(Ops::load(src + i), vth));
+	}
+	thresholdSpanScalar(src + i, dst + i, n - i, th);
+}
+
+#endif
+
+template<typename T>
+ElementwiseKernels<T> selectElementwiseKernels() {
+	ElementwiseKernels<T> kernels = { minSpanScalar<T>, maxSpanScalar<T>, clampSpanScalar<T>, thresholdSpanScalar<T> };
+
+#ifdef ML_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		kernels.min = minSpanAvx2<T>;
+		kernels.max = maxSpanAvx2<T>;
+		kernels.clamp = clampSpanAvx2<T>;
+		kernels.threshold = thresholdSpanAvx2<T>;
+	}
+#endif
+
+	return kernels;
+}
+
+template<typename T>
+const ElementwiseKernels<T>& elementwiseKernels() {
+	static const ElementwiseKernels<T> kernels = selectElementwiseKernels<T>();
+	return kernels;
+}
+
+/**
+ * 同じサイズの行列について、各行の要素の区間[begin, end)ごとにspan(r, begin, end)を呼び出す。
+ * 全ての行列が連続領域なら、全体を1行として扱う。
+ * 要素数がELEMENTWISE_PARALLEL_SIZE以上なら、スレッドプールで並列に処理する。
+ *
+ * @param rows			行数
+ * @param cols			1行の要素数 (列数 x チャンネル数)
+ * @param continuous	全ての行列が連続領域か
+ * @param span			区間ごとの処理
+ */
+template<typename F>
+void forEachSpan(int rows, int cols, bool continuous, const F& span) {
+	if (continuous) {
+		cols *= rows;
+		rows = 1;
+	}
+	int numThreads = (long long)rows * cols < ELEMENTWISE_PARALLEL_SIZE ? 1 : 0;
+
+	if (rows == 1) {
+		ThreadPool::instance().parallelFor(0, cols, [&](int begin, int end) {
+			span(0, begin, end);
+		}, numThreads);
+	} else {
+		ThreadPool::instance().parallelFor(0, rows, [&](int begin, int end) {
+			for (int r = begin; r < end; ++r) {
+				span(r, 0, cols);
+			}
+		}, numThreads);
+	}
+}
+
+/**
+ * double型の値を、T型に変換する。整数型の場合は、範囲内に収めてから切り捨てる。
+ */
+template<typename T>
+T saturateBound(double v) {
+	if (std::numeric_limits<T>::is_integer) {
+		v = std::min(std::max(v, (double)std::numeric_limits<T>::min()), (double)std::numeric_limits<T>::max());
+	}
+	return (T)v;
+}
+
+/**
+ * v > thresholdの判定をT型のままv > thで行えるよう、thresholdをT型に変換する。
+ * 整数型は切り捨て、浮動小数点型はthreshold以下で最大の値にする。
+ *
+ * @param threshold		しきい値
+ * @param th [OUT]		T型のしきい値
+ * @return				全ての値がしきい値より大きい (thで表せない) 場合はfalse
+ */
+template<typename T>
+bool thresholdBound(double threshold, T& th) {
+	if (std::numeric_limits<T>::is_integer) {
+		threshold = std::floor(threshold);
+		if (threshold < std::numeric_limits<T>::min()) return false;
+		th = saturateBound<T>(threshold);
+	} else {
+		th = (T)threshold;
+		if (th > threshold) th = std::nextafter(th, -std::numeric_limits<T>::infinity());
+	}
+	return true;
+}
+
+template<typename T>
+void matMinMaxImpl(const cv::Mat& m1, const cv::Mat& m2, cv::Mat& ret, bool takeMin) {
+	int cols = m1.cols * m1.channels();
+	void (*kernel)(const T*, const T*, T*, int) = takeMin ? elementwiseKernels<T>().min : elementwiseKernels<T>().max;
+
+	forEachSpan(m1.rows, cols, m1.isContinuous() && m2.isContinuous() && ret.isContinuous(), [&](int r, int begin, int end) {
+		kernel(m1.ptr<T>(r) + begin, m2.ptr<T>(r) + begin, ret.ptr<T>(r) + begin, end - begin);
+	});
+}
+
+template<typename T>
+void matClampImpl(cv::Mat& m, double min_val, double max_val) {
+	T lo = saturateBound<T>(min_val);
+	T hi = saturateBound<T>(max_val);
+
+	// 最小値 > 最大値の場合は、以前の実装と同じく、元の値で最小値、最大値の順に判定する
+	if (min_val > max_val) {
+		forEachSpan(m.rows, m.cols * m.channels(), m.isContinuous(), [&](int r, int begin, int end) {
+			T* p = m.ptr<T>(r);
+			for (int i = begin; i < end; ++i) {
+				double v = p[i];
+				if (v < min_val) p[i] = lo;
+				if (v > max_val) p[i] = hi;
+			}
+		});
+		return;
+	}
+
+	forEachSpan(m.rows, m.cols * m.channels(), m.isContinuous(), [&](int r, int begin, int end) {
+		elementwiseKernels<T>().clamp(m.ptr<T>(r) + begin, end - begin, lo, hi);
+	});
+}
+
+template<typename T>
+void matThresholdImpl(const cv::Mat& m, cv::Mat& ret, double threshold) {
+	T th;
+	if (!thresholdBound(threshold, th)) {
+		ret.setTo(1);
+		return;
+	}
+
+	forEachSpan(m.rows, m.cols * m.channels(), m.isContinuous() && ret.isContinuous(), [&](int r, int begin, int end) {
+		elementwiseKernels<T>().threshold(m.ptr<T>(r) + begin, ret.ptr<T>(r) + begin, end - begin, th);
+	});
+}
+
+cv::Mat matMinMax(const cv::Mat& m1, const cv::Mat& m2, bool takeMin) {
+	cv::Mat other = m2;
+	if (m2.type() != m1.type()) {
+		if (m1.depth() < CV_32F && m2.depth() >= CV_32F) {
+			// 元の値で比較してからm1の型に切り捨てるのと同じ結果になるよう、整数型へは切り捨てて変換する
+			// (convertToは四捨五入するので、例えば3と2.7のminが3になってしまう)
+			cv::Mat tmp;
+			m2.convertTo(tmp, CV_64F);
+			int cols = tmp.cols * tmp.channels();
+			for (int r = 0; r < tmp.rows; ++r) {
+				double* p = tmp.ptr<double>(r);
+				for (int c = 0; c < cols; ++c) {
+					p[c] = std::trunc(p[c]);
+				}
+			}
+			tmp.convertTo(other, m1.type());
+		} else {
+			m2.convertTo(other, m1.type());
+		}
+	}
+
+	cv::Mat ret(m1.rows, m1.cols, m1.type());
+	switch (m1.depth()) {
+	case CV_8U:
+		matMinMaxImpl<uchar>(m1, other, ret, takeMin);
+		break;
+	case CV_32F:
+		matMinMaxImpl<float>(m1, other, ret, takeMin);
+		break;
+	case CV_64F:
+		matMinMaxImpl<double>(m1, other, ret, takeMin);
+		break;
+	default:
+		if (takeMin) cv::min(m1, other, ret);
+		else cv::max(m1, other, ret);
+		break;
+	}
+
+	return ret;
+}
+
+// 行内の要素は、この個数以下になるまで半分に分割して足し合わせる (pairwise summation)
+const int PAIRWISE_BLOCK = 128;
+
+/**
+ * 行列の全要素の集計値。
+ * 和と二乗和は、区間内ではpairwise summation、区間の間では補償付き加算 (Neumaierの方法) で累積する。
+ */
+struct ElementReduction {
+	long long count;
+	double sum, sumError;
+	double squaredSum, squaredSumError;
+	double minimum, maximum;
+};
+
+void initReduction(ElementReduction& r) {
+	r.count = 0;
+	r.sum = r.sumError = 0.0;
+	r.squaredSum = r.squaredSumError = 0.0;
+	r.minimum = std::numeric_limits<double>::infinity();
+	r.maximum = -std::numeric_limits<double>::infinity();
+}
+
+/**
+ * sumにvを加え、丸め誤差をerrorに累積する (Neumaierの方法)。
+ */
+inline void compensatedAdd(double& sum, double& error, double v) {
+	double t = sum + v;
+	if (std::fabs(sum) >= std::fabs(v)) {
+		error += (sum - t) + v;
+	} else {
+		error += (v - t) + sum;
+	}
+	sum = t;
+}
+
+void mergeReduction(ElementReduction& r, const ElementReduction& other) {
+	r.count += other.count;
+	compensatedAdd(r.sum, r.sumError, other.sum);
+	r.sumError += other.sumError;
+	compensatedAdd(r.squaredSum, r.squaredSumError, other.squaredSum);
+	r.squaredSumError += other.squaredSumError;
+	if (other.minimum < r.minimum) r.minimum = other.minimum;
+	if (other.maximum > r.maximum) r.maximum = other.maximum;
+}
+
+/**
+ * 連続したn個の要素の和、二乗和を、pairwise summationで計算する。
+ * 最小値、最大値はlo、hiを更新する。1回の走査で全てを計算する。
+ */
+template<typename T>
+void reduceSpan(const T* p, int n, double& sum, double& squaredSum, double& lo, double& hi) {
+	if (n > PAIRWISE_BLOCK) {
+		int half = n / 2;
+		double sum2, squaredSum2;
+		reduceSpan(p, half, sum, squaredSum, lo, hi);
+		reduceSpan(p + half, n - half, sum2, squaredSum2, lo, hi);
+		sum += sum2;
+		squaredSum += squaredSum2;
+		return;
+	}
+
+	// 4つの独立した累積値に分けて、依存関係を減らす
+	double s[4] = { 0.0, 0.0, 0.0, 0.0 };
+	double q[4] = { 0.0, 0.0, 0.0, 0.0 };
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		for (int k = 0; k < 4; ++k) {
+			double v = p[i + k];
+			s[k] += v;
+			q[k] += v * v;
+			lo = v < lo ? v : lo;
+			hi = v > hi ? v : hi;
+		}
+	}
+	for (; i < n; ++i) {
+		double v = p[i];
+		s[0] += v;
+		q[0] += v * v;
+		lo = v < lo ? v : lo;
+		hi = v > hi ? v : hi;
+	}
+
+	sum = (s[0] + s[1]) + (s[2] + s[3]);
+	squaredSum = (q[0] + q[1]) + (q[2] + q[3]);
+}
+
+/**
+ * 行列の全要素について、要素数、和、二乗和、最小値、最大値を1回の走査で計算する。
+ * 連続領域なら全体を1行として要素で、そうでなければ行で区間に分け、スレッドプールで並列に計算する。
+ * 区間ごとの結果は、区間の順に結合する。
+ */
+template<typename T>
+void reduceElementsImpl(const cv::Mat& m, ElementReduction& result) {
+	int rows = m.rows;
+	int cols = m.cols * m.channels();
+	if (m.isContinuous()) {
+		cols *= rows;
+		rows = 1;
+	}
+	int numThreads = (long long)rows * cols < ELEMENTWISE_PARALLEL_SIZE ? 1 : 0;
+
+	mutex mtx;
+	vector<pair<int, ElementReduction> > partials;
+	ThreadPool::instance().parallelFor(0, rows == 1 ? cols : rows, [&](int begin, int end) {
+		ElementReduction partial;
+		initReduction(partial);
+
+		int spanRows = rows == 1 ? 1 : end - begin;
+		for (int i = 0; i < spanRows; ++i) {
+			const T* p = rows == 1 ? m.ptr<T>(0) + begin : m.ptr<T>(begin + i);
+			int n = rows == 1 ? end - begin : cols;
+
+			double sum, squaredSum;
+			reduceSpan(p, n, sum, squaredSum, partial.minimum, partial.maximum);
+			partial.count += n;
+			compensatedAdd(partial.sum, partial.sumError, sum);
+			compensatedAdd(partial.squaredSum, partial.squaredSumError, squaredSum);
+		}
+
+		lock_guard<mutex> lock(mtx);
+		partials.push_back(make_pair(begin, partial));
+	}, numThreads);
+
+	std::sort(partials.begin(), partials.end(), [](const pair<int, ElementReduction>& a, const pair<int, ElementReduction>& b) {
+		return a.first < b.first;
+	});
+	initReduction(result);
+	for (int i = 0; i < partials.size(); ++i) {
+		mergeReduction(result, partials[i].second);
+	}
+}
+
+ElementReduction reduceElements(const cv::Mat& m) {
+	ElementReduction result;
+	initReduction(result);
+	if (m.empty()) return result;
+
+	switch (m.depth()) {
+	case CV_8U: reduceElementsImpl<uchar>(m, result); break;
+	case CV_8S: reduceElementsImpl<schar>(m, result); break;
+	case CV_16U: reduceElementsImpl<ushort>(m, result); break;
+	case CV_16S: reduceElementsImpl<short>(m, result); break;
+	case CV_32S: reduceElementsImpl<int>(m, result); break;
+	case CV_32F: reduceElementsImpl<float>(m, result); break;
+	case CV_64F: reduceElementsImpl<double>(m, result); break;
+	}
+	return result;
+}
+
+/**
+ * 2つの行列の、列ごとの平均、偏差平方和と、偏差の積和。
+ */
+struct ColumnCoMoments {
+	long long count;
+	vector<double> meanX, meanY;
+	vector<double> m2X, m2Y;
+	vector<double> cXY;
+};
+
+void initCoMoments(ColumnCoMoments& moments, int D) {
+	moments.count = 0;
+	moments.meanX.assign(D, 0.0);
+	moments.meanY.assign(D, 0.0);
+	moments.m2X.assign(D, 0.0);
+	moments.m2Y.assign(D, 0.0);
+	moments.cXY.assign(D, 0.0);
+}
+
+/**
+ * 別のデータから計算した累積値otherを結合する (mergeMomentsと同じくChanらの方法)。
+ */
+void mergeCoMoments(ColumnCoMoments& moments, const ColumnCoMoments& other) {
+	if (other.count == 0) return;
+	if (moments.count == 0) {
+		moments = other;
+		return;
+	}
+
+	double n = moments.count + other.count;
+	double wb = other.count / n;
+	double scale = moments.count * wb;
+	for (int c = 0; c < moments.meanX.size(); ++c) {
+		double dx = other.meanX[c] - moments.meanX[c];
+		double dy = other.meanY[c] - moments.meanY[c];
+		moments.meanX[c] += dx * wb;
+		moments.meanY[c] += dy * wb;
+		moments.m2X[c] += other.m2X[c] + dx * dx * scale;
+		moments.m2Y[c] += other.m2Y[c] + dy * dy * scale;
+		moments.cXY[c] += other.cXY[c] + dx * dy * scale;
+	}
+	moments.count += other.count;
+}
+
+/**
+ * XとYの列ごとの平均、偏差平方和、偏差の積和を、1回の走査で計算する (Welfordの方法)。
+ * 行を区間に分けてスレッドプールで並列に計算し、区間の順に結合する。
+ */
+void columnCoMoments(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, ColumnCoMoments& moments) {
+	initCoMoments(moments, X.cols);
+
+	mutex mtx;
+	vector<pair<int, ColumnCoMoments> > partials;
+	int numThreads = (long long)X.rows * X.cols < ELEMENTWISE_PARALLEL_SIZE ? 1 : 0;
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		ColumnCoMoments partial;
+		initCoMoments(partial, X.cols);
+
+		for (int r = begin; r < end; ++r) {
+			const double* x = X[r];
+			const double* y = Y[r];
+			partial.count++;
+			double inv = 1.0 / partial.count;
+			for (int c = 0; c < X.cols; ++c) {
+				double dx = x[c] - partial.meanX[c];
+				double dy = y[c] - partial.meanY[c];
+				partial.meanX[c] += dx * inv;
+				partial.meanY[c] += dy * inv;
+				partial.m2X[c] += dx * (x[c] - partial.meanX[c]);
+				partial.m2Y[c] += dy * (y[c] - partial.meanY[c]);
+				partial.cXY[c] += dx * (y[c] - partial.meanY[c]);
+			}
+		}
+
+		lock_guard<mutex> lock(mtx);
+		partials.push_back(make_pair(begin, partial));
+	}, numThreads);
+
+	std::sort(partials.begin(), partials.end(), [](const pair<int, ColumnCoMoments>& a, const pair<int, ColumnCoMoments>& b) {
+		return a.first < b.first;
+	});
+	for (int i = 0; i < partials.size(); ++i) {
+		mergeCoMoments(moments, partials[i].second);
+	}
+}
+
+}
+
 /**
  * 行列の指定した行、列の値を返却する。
  *
@@ -280,80 +1407,61 @@ void mat_set_value(cv::Mat& m, int r, int c, double val) {
 	}
 }
 
+/**
+ * 行列の要素の最小値を返却する。中間の行列は作らず、1回の走査で計算する。
+ *
+ * @param m		行列
+ * @return		最小値
+ */
 double mat_min(const cv::Mat& m) {
-	cv::Mat tmp;
-	cv::reduce(m, tmp, 0, CV_REDUCE_MIN);
-	cv::reduce(tmp, tmp, 1, CV_REDUCE_MIN);
-
-	return mat_get_value(tmp, 0, 0);
+	return reduceElements(m).minimum;
 }
 
 /**
- * 2つの行列の、要素ごとのmaxを計算し、返却する。
+ * 2つの行列の、要素ごとのminを計算し、返却する。
+ * 結果はm1と同じ型になり、値で比較してから、m1の型に変換したものと同じになる (整数型へは切り捨て)。
+ * 要素の型ごとのカーネルで連続した要素をまとめて処理し、大きな行列は並列に処理する。
  *
  * @param m1		行列1
  * @param m2		行列2
- * @return			要素ごとのmax
+ * @return			要素ごとのmin
  */
 cv::Mat mat_min(const cv::Mat& m1, const cv::Mat& m2) {
-	cv::Mat ret = m1.clone();
-
-	for (int r = 0; r < m1.rows; ++r) {
-		for (int c = 0; c < m1.cols; ++c) {
-			double v1 = mat_get_value(m1, r, c);
-			double v2 = mat_get_value(m2, r, c);
-
-			if (v2 < v1) {
-				mat_set_value(ret, r, c, v2);
-			}
-		}
-	}
-	
-	return ret;
+	return matMinMax(m1, m2, true);
 }
 
+/**
+ * 行列の要素の最大値を返却する。中間の行列は作らず、1回の走査で計算する。
+ *
+ * @param m		行列
+ * @return		最大値
+ */
 double mat_max(const cv::Mat& m) {
-	cv::Mat tmp;
-	cv::reduce(m, tmp, 0, CV_REDUCE_MAX);
-	cv::reduce(tmp, tmp, 1, CV_REDUCE_MAX);
-
-	return mat_get_value(tmp, 0, 0);
+	return reduceElements(m).maximum;
 }
 
 /**
  * 2つの行列の、要素ごとのmaxを計算し、返却する。
+ * 結果はm1と同じ型になり、値で比較してから、m1の型に変換したものと同じになる (整数型へは切り捨て)。
+ * 要素の型ごとのカーネルで連続した要素をまとめて処理し、大きな行列は並列に処理する。
  *
  * @param m1		行列1
  * @param m2		行列2
  * @return			要素ごとのmax
  */
 cv::Mat mat_max(const cv::Mat& m1, const cv::Mat& m2) {
-	cv::Mat ret = m1.clone();
-
-	for (int r = 0; r < m1.rows; ++r) {
-		for (int c = 0; c < m1.cols; ++c) {
-			double v1 = mat_get_value(m1, r, c);
-			double v2 = mat_get_value(m2, r, c);
-
-			if (v2 > v1) {
-				mat_set_value(ret, r, c, v2);
-			}
-		}
-	}
-
-	return ret;
+	return matMinMax(m1, m2, false);
 }
 
 /**
  * 行列の要素和を返却する。
+ * 中間の行列は作らず、1回の走査で、丸め誤差を抑えて足し合わせる (reduceElementsを参照)。
  *
  * @param m		行列
  */
 double mat_sum(const cv::Mat& m) {
-	cv::Mat s;
-	cv::reduce(m, s, 0, CV_REDUCE_SUM);
-	cv::reduce(s, s, 1, CV_REDUCE_SUM);
-	return mat_get_value(s, 0, 0);
+	ElementReduction r = reduceElements(m);
+	return r.sum + r.sumError;
 }
 
 /**
@@ -367,29 +1475,42 @@ cv::Mat mat_square(const cv::Mat& m) {
 }
 
 /**
- * 行列の要素の二乗和を返却する。
+ * 行列の要素の二乗和を返却する。二乗した行列は作らない。
  *
  * @param m		行列
  * @return		行列の各要素の二乗和
  */
 double mat_squared_sum(const cv::Mat& m) {
-	return mat_sum(mat_square(m));
+	ElementReduction r = reduceElements(m);
+	return r.squaredSum + r.squaredSumError;
 }
 
 /**
  * 行列の各要素について、最小値より小さい値は最小値に、最大値より大きい値は最大値になるようにする。
+ * 整数型の行列では、最小値、最大値を型の範囲内に収めて切り捨てた値を使う。
  *
  * @param m			行列
  * @param min_val	最小値
  * @param max_val	最大値
  */
 void mat_clamp(cv::Mat& m, double min_val, double max_val) {
-	for (int r = 0; r < m.rows; ++r) {
-		for (int c = 0; c < m.cols; ++c) {
-			double v = mat_get_value(m, r, c);
-			if (v < min_val) mat_set_value(m, r, c, min_val);
-			if (v > max_val) mat_set_value(m, r, c, max_val);
+	switch (m.depth()) {
+	case CV_8U:
+		matClampImpl<uchar>(m, min_val, max_val);
+		break;
+	case CV_32F:
+		matClampImpl<float>(m, min_val, max_val);
+		break;
+	case CV_64F:
+		matClampImpl<double>(m, min_val, max_val);
+		break;
+	default: {
+			cv::Mat tmp;
+			m.convertTo(tmp, CV_64F);
+			matClampImpl<double>(tmp, min_val, max_val);
+			tmp.convertTo(m, m.type());
 		}
+		break;
 	}
 }
 
@@ -401,14 +1522,26 @@ void mat_clamp(cv::Mat& m, double min_val, double max_val) {
  * @return				結果の行列
  */
 cv::Mat mat_threhold(const cv::Mat& m, double threshold) {
-	cv::Mat ret(m.size(), m.type());
-
-	for (int r = 0; r < m.rows; ++r) {
-		for (int c = 0; c < m.cols; ++c) {
-			double v = mat_get_value(m, r, c);
-			if (v > threshold) mat_set_value(ret, r, c, 1.0);
-			else mat_set_value(ret, r, c, 0.0);
+	cv::Mat ret(m.rows, m.cols, m.type());
+
+	switch (m.depth()) {
+	case CV_8U:
+		matThresholdImpl<uchar>(m, ret, threshold);
+		break;
+	case CV_32F:
+		matThresholdImpl<float>(m, ret, threshold);
+		break;
+	case CV_64F:
+		matThresholdImpl<double>(m, ret, threshold);
+		break;
+	default: {
+			cv::Mat tmp, tmp2;
+			m.convertTo(tmp, CV_64F);
+			tmp2.create(tmp.rows, tmp.cols, tmp.type());
+			matThresholdImpl<double>(tmp, tmp2, threshold);
+			tmp2.convertTo(ret, m.type());
 		}
+		break;
 	}
 
 	return ret;
@@ -438,11 +1571,22 @@ void mat_save(char* filename, const cv::Mat& mat, bool normalize) {
 	cv::imwrite(filename, img);
 }
 
+/**
+ * 各列の (標本) 分散の和を返却する。
+ * 平均を引いた行列は作らず、columnMomentsで各列の偏差平方和を1回の走査で計算する。
+ *
+ * @param mat	行列 (各行が各データ)
+ * @return		各列の分散の和
+ */
 double mat_variance(const cv::Mat& mat) {
-	cv::Mat avg;
-	cv::reduce(mat, avg, 0, CV_REDUCE_AVG);
+	ColumnMoments moments;
+	columnMoments(cv::Mat_<double>(mat), moments);
 
-	return mat_squared_sum(mat - cv::repeat(avg, mat.rows, 1)) / mat.rows;
+	double sum = 0.0;
+	for (int c = 0; c < moments.m2.size(); ++c) {
+		sum += moments.m2[c];
+	}
+	return sum / mat.rows;
 }
 
 /**
@@ -477,44 +1621,52 @@ cv::Mat mat_mask(const cv::Mat& m, const cv::Mat& mask, float alpha) {
 	return m * (1.0 - alpha) + m2 * alpha;
 }
 
+/**
+ * 2つのデータの相関係数を返却する。
+ * 行ベクトルは列ベクトルとして扱う (コピーはしない)。
+ * 行列の場合は、列ごとに平均を引いた偏差について計算する。
+ * 平均を引いた行列や積の行列は作らず、偏差平方和と偏差の積和を1回の走査で計算する。
+ *
+ * @param m1	データ1
+ * @param m2	データ2
+ * @return		相関係数
+ */
 double correlation(const cv::Mat_<double>& m1, const cv::Mat_<double>& m2) {
 	// 列ベクトルにする
 	cv::Mat_<double> mat1 = m1;
-	if (mat1.rows == 1) mat1 = mat1.t();
+	if (mat1.rows == 1) mat1 = mat1.reshape(1, mat1.cols);
 	cv::Mat_<double> mat2 = m2;
-	if (mat2.rows == 2) mat2 = mat2.t();
-
-	// データ数
-	int N = mat1.rows;
-
-	// 平均を計算する
-	cv::Mat_<double> avg1;
-	cv::reduce(mat1, avg1, 0, CV_REDUCE_AVG);
-	cv::Mat_<double> avg2;
-	cv::reduce(mat2, avg2, 0, CV_REDUCE_AVG);
+	if (mat2.rows == 1) mat2 = mat2.reshape(1, mat2.cols);
+	CV_Assert(mat1.size() == mat2.size());
 
-	cv::Mat_<double> mat1_hat = mat1 - cv::repeat(avg1, N, 1);
-	cv::Mat_<double> mat2_hat = mat2 - cv::repeat(avg2, N, 1);
+	ColumnCoMoments moments;
+	columnCoMoments(mat1, mat2, moments);
 
-	return mat_sum(mat1_hat.mul(mat2_hat)) / sqrt(mat_sum(mat1_hat.mul(mat1_hat))) / sqrt(mat_sum(mat2_hat.mul(mat2_hat)));
+	double cXY = 0.0, m2X = 0.0, m2Y = 0.0;
+	for (int c = 0; c < mat1.cols; ++c) {
+		cXY += moments.cXY[c];
+		m2X += moments.m2X[c];
+		m2Y += moments.m2Y[c];
+	}
+	return cXY / sqrt(m2X) / sqrt(m2Y);
 }
 
 /**
- * 平均と標準偏差を計算する。
- * srcの各行が各データ。
+ * 平均と標準偏差 (不偏標準偏差) を計算する。
+ * srcの各行が各データ。全ての列の統計量を、1回の走査で計算する (columnMomentsを参照)。
  */
 void meanStdDev(const cv::Mat& src, cv::Mat_<double>& mean, cv::Mat_<double>& stddev) {
 	int N = src.rows;
 
+	ColumnMoments moments;
+	columnMoments(cv::Mat_<double>(src), moments);
+
 	mean = cv::Mat_<double>(1, src.cols);
 	stddev = cv::Mat_<double>(1, src.cols);
 
 	for (int c = 0; c < src.cols; ++c) {
-		cv::Scalar m, s;
-		cv::meanStdDev(src.col(c), m, s);
-
-		mean(0, c) = m.val[0];
-		stddev(0, c) = s.val[0] * sqrt((double)N / (N - 1));
+		mean(0, c) = moments.mean[c];
+		stddev(0, c) = sqrt(moments.m2[c] / (N - 1));
 	}
 }
 
@@ -543,71 +1695,299 @@ double rmse(const cv::Mat_<double>& trueData, const cv::Mat_<double>& predData,
 	return error(0, 0);
 }
 
-void initRand(int seed) {
-	srand(seed);
+namespace {
 
-	int n = seed % 13;
-	for (int i = 0; i < n; ++i) {
-		genRand();
+/**
+ * 距離計算のカーネル。CPUが対応する命令セットに応じて、実行時に1つを選ぶ。
+ */
+template<typename T>
+struct DistanceKernels {
+	T (*one)(const T* a, const T* b, int D);
+	void (*many)(const T* x, const T* rows, int count, int D, T* dists);
+};
+
+template<typename T>
+T squaredDistanceScalar(const T* a, const T* b, int D) {
+	T d = 0;
+	for (int c = 0; c < D; ++c) {
+		T diff = a[c] - b[c];
+		d += diff * diff;
+	}
+	return d;
+}
+
+template<typename T>
+void squaredDistancesScalar(const T* x, const T* rows, int count, int D, T* dists) {
+	for (int i = 0; i < count; ++i) {
+		dists[i] = squaredDistanceScalar(x, rows + (size_t)i * D, D);
 	}
 }
 
+#ifdef ML_SIMD_X86
+
+__attribute__((target("avx2,fma")))
+double squaredDistanceAvx2(const double* a, const double* b, int D) {
+	__m256d acc = _mm256_setzero_pd();
+	int c = 0;
+	for (; c + 4 <= D; c += 4) {
+		__m256d diff = _mm256_sub_pd(_mm256_loadu_pd(a + c), _mm256_loadu_pd(b + c));
+		acc = _mm256_fmadd_pd(diff, diff, acc);
+	}
+
+	__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+	sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+	double d = _mm_cvtsd_f64(sum);
+	for (; c < D; ++c) {
+		double diff = a[c] - b[c];
+		d += diff * diff;
+	}
+	return d;
+}
+
+__attribute__((target("avx2,fma")))
+float squaredDistanceAvx2(const float* a, const float* b, int D) {
+	__m256 acc = _mm256_setzero_ps();
+	int c = 0;
+	for (; c + 8 <= D; c += 8) {
+		__m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + c), _mm256_loadu_ps(b + c));
+		acc = _mm256_fmadd_ps(diff, diff, acc);
+	}
+
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	float d = _mm_cvtss_f32(sum);
+	for (; c < D; ++c) {
+		float diff = a[c] - b[c];
+		d += diff * diff;
+	}
+	return d;
+}
+
 /**
- * Uniform乱数[0, 1)を生成する
+ * D = 2の場合は、複数の行をまとめて計算する (doubleは4行、floatは8行)。
+ * それ以外で次元数が小さい場合は、スカラー演算の方が速い。
  */
-float genRand() {
-	return rand() / (float(RAND_MAX) + 1);
+__attribute__((target("avx2,fma")))
+void squaredDistancesAvx2(const double* x, const double* rows, int count, int D, double* dists) {
+	int i = 0;
+	if (D == 2) {
+		__m256d xx = _mm256_setr_pd(x[0], x[1], x[0], x[1]);
+		for (; i + 4 <= count; i += 4) {
+			__m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(rows + i * 2), xx);
+			__m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(rows + i * 2 + 4), xx);
+			__m256d sum = _mm256_hadd_pd(_mm256_mul_pd(d0, d0), _mm256_mul_pd(d1, d1));
+			_mm256_storeu_pd(dists + i, _mm256_permute4x64_pd(sum, 0xD8));
+		}
+	} else if (D >= 4) {
+		for (; i < count; ++i) {
+			dists[i] = squaredDistanceAvx2(x, rows + (size_t)i * D, D);
+		}
+	}
+
+	for (; i < count; ++i) {
+		dists[i] = squaredDistanceScalar(x, rows + (size_t)i * D, D);
+	}
+}
+
+__attribute__((target("avx2,fma")))
+void squaredDistancesAvx2(const float* x, const float* rows, int count, int D, float* dists) {
+	int i = 0;
+	if (D == 2) {
+		__m256 xx = _mm256_setr_ps(x[0], x[1], x[0], x[1], x[0], x[1], x[0], x[1]);
+		for (; i + 8 <= count; i += 8) {
+			__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(rows + i * 2), xx);
+			__m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(rows + i * 2 + 8), xx);
+			__m256 sum = _mm256_hadd_ps(_mm256_mul_ps(d0, d0), _mm256_mul_ps(d1, d1));
+			_mm256_storeu_ps(dists + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sum), 0xD8)));
+		}
+	} else if (D >= 8) {
+		for (; i < count; ++i) {
+			dists[i] = squaredDistanceAvx2(x, rows + (size_t)i * D, D);
+		}
+	}
+
+	for (; i < count; ++i) {
+		dists[i] = squaredDistanceScalar(x, rows + (size_t)i * D, D);
+	}
+}
+
+__attribute__((target("avx512f")))
+double squaredDistanceAvx512(const double* a, const double* b, int D) {
+	__m512d acc = _mm512_setzero_pd();
+	int c = 0;
+	for (; c + 8 <= D; c += 8) {
+		__m512d diff = _mm512_sub_pd(_mm512_loadu_pd(a + c), _mm512_loadu_pd(b + c));
+		acc = _mm512_fmadd_pd(diff, diff, acc);
+	}
+	if (c < D) {
+		__mmask8 mask = (__mmask8)((1 << (D - c)) - 1);
+		__m512d diff = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, a + c), _mm512_maskz_loadu_pd(mask, b + c));
+		acc = _mm512_fmadd_pd(diff, diff, acc);
+	}
+	return _mm512_reduce_add_pd(acc);
+}
+
+__attribute__((target("avx512f")))
+float squaredDistanceAvx512(const float* a, const float* b, int D) {
+	__m512 acc = _mm512_setzero_ps();
+	int c = 0;
+	for (; c + 16 <= D; c += 16) {
+		__m512 diff = _mm512_sub_ps(_mm512_loadu_ps(a + c), _mm512_loadu_ps(b + c));
+		acc = _mm512_fmadd_ps(diff, diff, acc);
+	}
+	if (c < D) {
+		__mmask16 mask = (__mmask16)((1 << (D - c)) - 1);
+		__m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + c), _mm512_maskz_loadu_ps(mask, b + c));
+		acc = _mm512_fmadd_ps(diff, diff, acc);
+	}
+	return _mm512_reduce_add_ps(acc);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void squaredDistancesAvx512(const double* x, const double* rows, int count, int D, double* dists) {
+	if (D < 8) {
+		squaredDistancesAvx2(x, rows, count, D, dists);
+		return;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		dists[i] = squaredDistanceAvx512(x, rows + (size_t)i * D, D);
+	}
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void squaredDistancesAvx512(const float* x, const float* rows, int count, int D, float* dists) {
+	if (D < 16) {
+		squaredDistancesAvx2(x, rows, count, D, dists);
+		return;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		dists[i] = squaredDistanceAvx512(x, rows + (size_t)i * D, D);
+	}
+}
+
+#endif
+
+template<typename T>
+DistanceKernels<T> selectDistanceKernels() {
+	DistanceKernels<T> kernels = { squaredDistanceScalar<T>, squaredDistancesScalar<T> };
+
+#ifdef ML_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		kernels.one = squaredDistanceAvx512;
+		kernels.many = squaredDistancesAvx512;
+	} else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		kernels.one = squaredDistanceAvx2;
+		kernels.many = squaredDistancesAvx2;
+	}
+#endif
+
+	return kernels;
+}
+
+template<typename T>
+const DistanceKernels<T>& distanceKernels() {
+	static const DistanceKernels<T> kernels = selectDistanceKernels<T>();
+	return kernels;
+}
+
+template<typename T>
+void squaredDistancesImpl(const cv::Mat_<T>& A, const cv::Mat_<T>& B, cv::Mat_<T>& dists, int numThreads) {
+	cv::Mat_<T> rows = B.isContinuous() ? B : B.clone();
+	dists.create(A.rows, B.rows);
+
+	ThreadPool::instance().parallelFor(0, A.rows, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			distanceKernels<T>().many(A[r], rows[0], rows.rows, rows.cols, dists[r]);
+		}
+	}, numThreads);
+}
+
 }
 
 /**
- * 指定された範囲[a, b)のUniform乱数を生成する
+ * 2点間のユークリッド距離の二乗を返却する。
+ * AVX-512 / AVX2に対応したCPUでは、SIMD命令で計算する。
+ *
+ * @param a		点a (D次元)
+ * @param b		点b (D次元)
+ * @param D		次元数
+ * @return		距離の二乗
  */
-float genRand(float a, float b) {
-	return genRand() * (b - a) + a;
+double squaredDistance(const double* a, const double* b, int D) {
+	return distanceKernels<double>().one(a, b, D);
+}
+
+float squaredDistance(const float* a, const float* b, int D) {
+	return distanceKernels<float>().one(a, b, D);
 }
 
 /**
- * Normal distributionを使用して乱数を生成する。
+ * 点xから、連続領域に行優先で並んだcount個の点までのユークリッド距離の二乗を計算する。
+ *
+ * @param x				点x (D次元)
+ * @param rows			点 (count x D、連続領域)
+ * @param count			点の数
+ * @param D				次元数
+ * @param dists [OUT]	距離の二乗 (count個)
  */
-float genRandNormal(float mean, float variance) {
-	/*
-	static std::default_random_engine generator;
+void squaredDistances(const double* x, const double* rows, int count, int D, double* dists) {
+	distanceKernels<double>().many(x, rows, count, D, dists);
+}
 
-	std::normal_distribution<float> distribution(mean, sqrtf(variance));
-	return distribution(generator);
-	*/
+void squaredDistances(const float* x, const float* rows, int count, int D, float* dists) {
+	distanceKernels<float>().many(x, rows, count, D, dists);
+}
 
-#if 1
-	float m = mean;
-	float s = sqrt(variance);
+/**
+ * Aの各行から、Bの各行までのユークリッド距離の二乗を計算する。
+ * Aの行を区間に分けて、スレッドプールで並列に計算する。
+ *
+ * @param A				点 (M x D)
+ * @param B				点 (N x D)
+ * @param dists [OUT]	距離の二乗 (M x N)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ */
+void squaredDistances(const cv::Mat_<double>& A, const cv::Mat_<double>& B, cv::Mat_<double>& dists, int numThreads) {
+	squaredDistancesImpl(A, B, dists, numThreads);
+}
 
-	/* mean m, standard deviation s */
-	float x1, x2, w, y1;
-	static float y2;
-	static int use_last = 0;
+void squaredDistances(const cv::Mat_<float>& A, const cv::Mat_<float>& B, cv::Mat_<float>& dists, int numThreads) {
+	squaredDistancesImpl(A, B, dists, numThreads);
+}
 
-	if (use_last) {	/* use value from previous call */
-		y1 = y2;
-		use_last = 0;
-	} else {
-		do {
-			x1 = 2.0 * genRand(0.0f, 1.0f) - 1.0;
-			x2 = 2.0 * genRand(0.0f, 1.0f) - 1.0;
-			w = x1 * x1 + x2 * x2;
-		} while ( w >= 1.0 );
+void initRand(int seed) {
+	Random::seedLocal(seed);
+}
 
-		w = sqrt( (-2.0 * ::log( w ) ) / w );
-		y1 = x1 * w;
-		y2 = x2 * w;
-		use_last = 1;
-	}
+/**
+ * Uniform乱数[0, 1)を生成する。
+ * 呼び出したスレッドのストリーム (Random::local) を使うので、ロックせずに並列に呼び出せる。
+ */
+float genRand() {
+	return Random::local().uniformFloat();
+}
 
-	return m + y1 * s;
-#endif
+/**
+ * 指定された範囲[a, b)のUniform乱数を生成する
+ */
+float genRand(float a, float b) {
+	return genRand() * (b - a) + a;
+}
+
+/**
+ * Normal distributionを使用して乱数を生成する。
+ * polar法の2つ目の値は、スレッドごとのストリームが保持する。
+ */
+float genRandNormal(float mean, float variance) {
+	return (float)Random::local().normal(mean, sqrt(variance));
 }
 
 float genRandInt(float a, float b, int num) {
-	int r = genRand(0, num);
+	int r = Random::local().uniformInt(num);
 	return a + (b - a) / (float)(num - 1) * r;
 }
 
@@ -1,23 +1,60 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
+#include "MappedFile.h"
 
 namespace ml {
 
+/**
+ * バイナリ形式のデータセットのヘッダ (64バイト)。
+ * ヘッダの後、dataOffsetの位置から、rows x colsの値が行優先で並ぶ。
+ * dataOffsetは64バイト境界に揃えるので、マップしたファイルをそのまま行列として使える。
+ */
+struct DatasetHeader {
+	char magic[4];			// "MLDS"
+	int version;			// フォーマットのバージョン (旧形式は0)
+	unsigned int endian;	// 書き込んだマシンでの0x01020304
+	int dtype;				// CV_64F / CV_32F
+	long long rows;
+	long long cols;
+	long long dataOffset;	// ファイル先頭から値までのバイト数
+	char reserved[24];
+};
+
+/**
+ * 列ごとのデータ数、平均、平均からの偏差の二乗和 (Welford法の累積値)。
+ * 別々のデータから計算したものをmergeMomentsで結合できるので、チャンクやシャードごとに並列に計算できる。
+ */
+struct ColumnMoments {
+	long long count;
+	std::vector<double> mean;
+	std::vector<double> m2;
+};
+
 std::vector<std::string> splitDataset(const std::string &str, char sep);
+bool parseDatasetLine(const std::string& str, std::vector<double>& rec);
 void splitDataset(const cv::Mat_<double>& data, float ratio1, cv::Mat_<double>& data1, cv::Mat_<double>& data2);
 void splitDataset(const cv::Mat_<double>& data, float ratio1, float ratio2, cv::Mat_<double>& data1, cv::Mat_<double>& data2, cv::Mat_<double>& data3);
 void shuffle(cv::Mat_<double>& data);
 bool loadDataset(char* filename, cv::Mat_<double>& X, bool binary = false);
 void saveDataset(char* filename, const cv::Mat_<double>& mat, bool binary = false);
+bool readDatasetHeader(std::istream& is, DatasetHeader& header);
+bool readDatasetValues(std::istream& is, const DatasetHeader& header, double* values, long long count);
+bool mapDataset(const char* filename, MappedFile& file, cv::Mat_<double>& mat);
 void normalizeDataset(cv::Mat_<double> mat, cv::Mat_<double>& normalized_mat, cv::Mat_<double>& mean, cv::Mat_<double>& stddev);
 void normalizeDataset2(cv::Mat_<double> mat, cv::Mat_<double>& normalized_mat, cv::Mat_<double>& mean, cv::Mat_<double>& stddev);
+void columnMinMax(const cv::Mat_<double>& src, cv::Mat_<double>& minimum, cv::Mat_<double>& maximum, int numThreads = 0);
+void columnMoments(const cv::Mat_<double>& src, ColumnMoments& moments, int numThreads = 0);
+void mergeMoments(ColumnMoments& moments, const ColumnMoments& other);
+void normalize(cv::Mat_<double>& mat, const cv::Mat_<double>& mean, const cv::Mat_<double>& stddev, int numThreads = 0);
+void denormalize(cv::Mat_<double>& mat, const cv::Mat_<double>& mean, const cv::Mat_<double>& stddev, int numThreads = 0);
 void addBias(cv::Mat& data);
 void quadratic_dataset(const cv::Mat_<double>& data, cv::Mat_<double>& data2);
 
@@ -41,6 +78,14 @@ double correlation(const cv::Mat_<double>& m1, const cv::Mat_<double>& m2);
 void meanStdDev(const cv::Mat& src, cv::Mat_<double>& mean, cv::Mat_<double>& stddev);
 double rmse(const cv::Mat_<double>& trueData, const cv::Mat_<double>& predData, bool averageColumns);
 
+// distance
+double squaredDistance(const double* a, const double* b, int D);
+float squaredDistance(const float* a, const float* b, int D);
+void squaredDistances(const double* x, const double* rows, int count, int D, double* dists);
+void squaredDistances(const float* x, const float* rows, int count, int D, float* dists);
+void squaredDistances(const cv::Mat_<double>& A, const cv::Mat_<double>& B, cv::Mat_<double>& dists, int numThreads = 0);
+void squaredDistances(const cv::Mat_<float>& A, const cv::Mat_<float>& B, cv::Mat_<float>& dists, int numThreads = 0);
+
 
 template<typename T>
 T sqr(T val) { return val * val; }
@@ -52,15 +97,16 @@ float genRand(float a, float b);
 float genRandNormal(float mean, float variance);
 float genRandInt(float a, float b, int num);
 
+/**
+ * 累積分布cdfからサンプリングする。cdfは単調増加なので、二分探索で求める。
+ * 同じ分布から何度もサンプリングする場合は、DiscreteSamplerを使う方が良い。
+ */
 template<typename T>
 int sampleFromCdf(const std::vector<T> &cdf) {
 	float rnd = genRand(0, cdf.back());
 
-	for (int i = 0; i < cdf.size(); ++i) {
-		if (rnd <= cdf[i]) return i;
-	}
-
-	return cdf.size() - 1;
+	int i = std::lower_bound(cdf.begin(), cdf.end(), rnd) - cdf.begin();
+	return std::min(i, (int)cdf.size() - 1);
 }
 
 template<typename T>
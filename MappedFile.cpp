@@ -0,0 +1,108 @@
+﻿#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : addr(NULL), length(0) {
+#ifdef _WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#endif
+}
+
+MappedFile::MappedFile(const char* filename) : addr(NULL), length(0) {
+#ifdef _WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#endif
+	open(filename);
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+/**
+ * ファイルをメモリにマップする。
+ * もしファイルがオープンできない場合、または空のファイルの場合は、falseを返却する。
+ *
+ * @param filename		ファイル名
+ */
+bool MappedFile::open(const char* filename) {
+	close();
+
+#ifdef _WIN32
+	fileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+		close();
+		return false;
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == NULL) {
+		close();
+		return false;
+	}
+
+	addr = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (addr == NULL) {
+		close();
+		return false;
+	}
+	length = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) return false;
+
+	addr = p;
+	length = st.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (addr != NULL) UnmapViewOfFile(addr);
+	if (mappingHandle != NULL) CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+	mappingHandle = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (addr != NULL) munmap(addr, length);
+#endif
+
+	addr = NULL;
+	length = 0;
+}
+
+bool MappedFile::isOpen() const {
+	return addr != NULL;
+}
+
+const char* MappedFile::data() const {
+	return (const char*)addr;
+}
+
+size_t MappedFile::size() const {
+	return length;
+}
@@ -0,0 +1,34 @@
+﻿#pragma once
+
+#include <cstddef>
+
+/**
+ * ファイルを読み込み専用でメモリにマップする。
+ * マップしたページはOSのページキャッシュを共有するので、複数のプロセスで同じファイルを開いてもメモリは増えない。
+ * dataが指す領域は、closeするか、このオブジェクトが破棄されるまで有効。
+ */
+class MappedFile {
+private:
+	void* addr;
+	size_t length;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#endif
+
+public:
+	MappedFile();
+	MappedFile(const char* filename);
+	~MappedFile();
+
+	bool open(const char* filename);
+	void close();
+	bool isOpen() const;
+	const char* data() const;
+	size_t size() const;
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
@@ -0,0 +1,207 @@
+﻿#include "ModelFile.h"
+#include <fstream>
+#include <cstring>
+#include <climits>
+
+using namespace std;
+
+namespace {
+	const char MODEL_MAGIC[4] = { 'M', 'L', 'M', 'D' };
+	const int MODEL_VERSION = 1;
+	const unsigned int MODEL_ENDIAN = 0x01020304;
+	const long long MODEL_ALIGNMENT = 64;
+
+	long long alignOffset(long long offset) {
+		return (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+	}
+}
+
+ModelFile::ModelFile() {
+}
+
+ModelFile::ModelFile(const char* type) : modelType(type) {
+}
+
+/**
+ * モデルの種類を返却する。
+ */
+const std::string& ModelFile::type() const {
+	return modelType;
+}
+
+/**
+ * 行列をセクションとして追加する。値はsaveするまで共有されるので、それまで変更しないこと。
+ * 同じ名前のセクションが既にある場合は、置き換える。
+ *
+ * @param name		セクション名 (31文字まで)
+ * @param mat		行列
+ */
+void ModelFile::add(const char* name, const cv::Mat_<double>& mat) {
+	Section section;
+	memset(&section, 0, sizeof(Section));
+	strncpy(section.name, name, sizeof(section.name) - 1);
+	section.rows = mat.rows;
+	section.cols = mat.cols;
+
+	int index = find(section.name);
+	if (index >= 0) {
+		sections[index] = section;
+		mats[index] = mat;
+	} else {
+		sections.push_back(section);
+		mats.push_back(mat);
+	}
+}
+
+/**
+ * スカラー値を、1x1の行列のセクションとして追加する。
+ *
+ * @param name		セクション名 (31文字まで)
+ * @param value		値
+ */
+void ModelFile::add(const char* name, double value) {
+	add(name, cv::Mat_<double>(1, 1, value));
+}
+
+bool ModelFile::has(const char* name) const {
+	return find(name) >= 0;
+}
+
+/**
+ * セクションの行列を返却する。
+ * loadした場合、行列はマップした領域を直接指すので、このオブジェクトより長く使う場合はcloneすること。
+ *
+ * @param name			セクション名
+ * @param mat [OUT]		行列
+ * @return				セクションがなければfalse
+ */
+bool ModelFile::get(const char* name, cv::Mat_<double>& mat) const {
+	int index = find(name);
+	if (index < 0) return false;
+
+	mat = mats[index];
+	return true;
+}
+
+/**
+ * 1x1のセクションの値を返却する。
+ *
+ * @param name			セクション名
+ * @param value [OUT]	値
+ * @return				セクションがない、または1x1でなければfalse
+ */
+bool ModelFile::get(const char* name, double& value) const {
+	int index = find(name);
+	if (index < 0 || mats[index].rows != 1 || mats[index].cols != 1) return false;
+
+	value = mats[index](0, 0);
+	return true;
+}
+
+/**
+ * 全セクションをファイルに保存する。
+ *
+ * @param filename		ファイル名
+ * @return				書き込めなければfalse
+ */
+bool ModelFile::save(const char* filename) const {
+	ofstream ofs(filename, ios::binary);
+	if (!ofs) return false;
+
+	Header header;
+	memset(&header, 0, sizeof(Header));
+	memcpy(header.magic, MODEL_MAGIC, 4);
+	header.version = MODEL_VERSION;
+	header.endian = MODEL_ENDIAN;
+	header.sectionCount = sections.size();
+	strncpy(header.type, modelType.c_str(), sizeof(header.type) - 1);
+
+	// 各セクションの値の位置を決める
+	vector<Section> table = sections;
+	long long offset = alignOffset(sizeof(Header) + sizeof(Section) * table.size());
+	for (int i = 0; i < table.size(); ++i) {
+		table[i].offset = offset;
+		offset = alignOffset(offset + sizeof(double) * table[i].rows * table[i].cols);
+	}
+
+	ofs.write((char*)&header, sizeof(Header));
+	if (!table.empty()) {
+		ofs.write((char*)&table[0], sizeof(Section) * table.size());
+	}
+
+	char padding[MODEL_ALIGNMENT] = { 0 };
+	long long pos = sizeof(Header) + sizeof(Section) * table.size();
+	for (int i = 0; i < table.size(); ++i) {
+		ofs.write(padding, table[i].offset - pos);
+		for (int r = 0; r < mats[i].rows; ++r) {
+			ofs.write((char*)mats[i][r], sizeof(double) * mats[i].cols);
+		}
+		pos = table[i].offset + sizeof(double) * table[i].rows * table[i].cols;
+	}
+
+	return ofs.good();
+}
+
+/**
+ * ファイルをメモリにマップして、セクションの一覧を読み込む。
+ * 値はコピーせず、getで返す行列はマップした領域を直接指す。
+ *
+ * @param filename		ファイル名
+ * @return				ファイルが読めない、または形式が正しくなければfalse
+ */
+bool ModelFile::load(const char* filename) {
+	modelType.clear();
+	sections.clear();
+	mats.clear();
+	if (!file.open(filename)) return false;
+
+	Header header;
+	if (file.size() < sizeof(Header)) {
+		file.close();
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(Header));
+
+	if (memcmp(header.magic, MODEL_MAGIC, 4) != 0 || header.version != MODEL_VERSION || header.endian != MODEL_ENDIAN
+		|| header.sectionCount < 0 || sizeof(Header) + sizeof(Section) * header.sectionCount > file.size()) {
+		file.close();
+		return false;
+	}
+
+	sections.resize(header.sectionCount);
+	if (!sections.empty()) {
+		memcpy(&sections[0], file.data() + sizeof(Header), sizeof(Section) * header.sectionCount);
+	}
+
+	// 値はセクションの一覧より後ろにあり、行数と列数はcv::Mat_に渡せる範囲とする。
+	// 符号なしの演算で回り込まないよう、バイト数は残りの大きさを割って比較する
+	long long tableEnd = sizeof(Header) + sizeof(Section) * header.sectionCount;
+	long long fileSize = file.size();
+	for (int i = 0; i < sections.size(); ++i) {
+		const Section& section = sections[i];
+		if (section.rows < 0 || section.cols < 0 || section.rows > INT_MAX || section.cols > INT_MAX
+			|| section.offset < tableEnd || section.offset > fileSize || section.offset % (long long)sizeof(double) != 0
+			|| (section.cols != 0 && section.rows > (fileSize - section.offset) / ((long long)sizeof(double) * section.cols))) {
+			sections.clear();
+			mats.clear();
+			file.close();
+			return false;
+		}
+
+		mats.push_back(cv::Mat_<double>(section.rows, section.cols, (double*)(file.data() + section.offset)));
+	}
+
+	header.type[sizeof(header.type) - 1] = '\0';
+	modelType = header.type;
+
+	return true;
+}
+
+int ModelFile::find(const char* name) const {
+	for (int i = 0; i < sections.size(); ++i) {
+		if (strncmp(sections[i].name, name, sizeof(sections[i].name)) == 0) return i;
+	}
+
+	return -1;
+}
+
@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv/cv.h>
+#include "MappedFile.h"
+
+/**
+ * 学習済みモデルのバイナリファイル。
+ * 名前付きの行列 (セクション) を並べて保存する。重み、クラスタの重心、正規化の平均・標準偏差などを1つのファイルにまとめられる。
+ * 各セクションの値は64バイト境界に揃えて行優先で並べるので、読み込み時はファイルをメモリにマップし、そのまま行列として参照する。
+ *
+ * ファイルの構成:
+ *   Header (64バイト)
+ *   Section x sectionCount (各64バイト)
+ *   各セクションの値 (double、64バイト境界)
+ */
+class ModelFile {
+public:
+	struct Header {
+		char magic[4];			// "MLMD"
+		int version;
+		unsigned int endian;	// 書き込んだマシンでの0x01020304
+		int sectionCount;
+		char type[32];			// モデルの種類 (クラス名)
+		char reserved[16];
+	};
+
+	struct Section {
+		char name[32];
+		long long rows;
+		long long cols;
+		long long offset;		// ファイル先頭から値までのバイト数
+		char reserved[8];
+	};
+
+private:
+	std::string modelType;
+	std::vector<Section> sections;
+	std::vector<cv::Mat_<double> > mats;	// loadした場合は、マップした領域を指す
+	MappedFile file;
+
+public:
+	ModelFile();
+	ModelFile(const char* type);
+
+	const std::string& type() const;
+	void add(const char* name, const cv::Mat_<double>& mat);
+	void add(const char* name, double value);
+	bool has(const char* name) const;
+	bool get(const char* name, cv::Mat_<double>& mat) const;
+	bool get(const char* name, double& value) const;
+
+	bool save(const char* filename) const;
+	bool load(const char* filename);
+
+private:
+	int find(const char* name) const;
+
+	ModelFile(const ModelFile&);
+	ModelFile& operator=(const ModelFile&);
+};
+
@@ -1,8 +1,29 @@
 ﻿#include "NearestNeighborRegression.h"
+#include "MLUtils.h"
+#include "ThreadPool.h"
+#include <cstring>
 
 NearestNeighborRegression::NearestNeighborRegression() {
 }
 
+/**
+ * データX、Yを登録し、Xに対してk-d treeを構築する。
+ * 以後、X、Yを渡さない方のpredictで予測できる。
+ * 単精度で推論するためのfloatのk-d treeとYも、合わせて作る。
+ *
+ * @param X				データX
+ * @param Y				データY
+ */
+NearestNeighborRegression::NearestNeighborRegression(const cv::Mat_<double>& X, const cv::Mat_<double>& Y) {
+	this->Y = Y.clone();
+	index.build(X);
+
+	cv::Mat_<float> floatX;
+	X.convertTo(floatX, CV_32F);
+	Y.convertTo(floatY, CV_32F);
+	floatIndex.build(floatX);
+}
+
 /**
  * Nearest neighborを使って、xに対応するyを探して返却する。
  *
@@ -16,15 +37,142 @@ cv::Mat_<double> NearestNeighborRegression::predict(const cv::Mat_<double>& X, c
 	int best_index;
 	dist = std::numeric_limits<double>::max();
 	for (int r = 0; r < X.rows; ++r) {
-		double d = cv::norm(X.row(r) - x);
+		double d = ml::squaredDistance(X[r], x[0], X.cols);
 		if (d < dist) {
 			dist = d;
 			best_index = r;
 		}
 	}
+	dist = sqrt(dist);
 
 	return Y.row(best_index);
 }
 
 
 
+/**
+ * 登録済みのデータから、xのk近傍を探し、対応するyの平均を返却する。
+ * eps > 0なら近似探索となる (KDTree::knnSearchを参照)。
+ * データが登録されていない、またはk <= 0の場合は、空の行列を返却する。
+ *
+ * @param x				データx
+ * @param dist [OUT]	nearest neighborまでの距離
+ * @param k				近傍の数
+ * @param eps			近似の許容誤差
+ * @return				yの予測値
+ */
+cv::Mat_<double> NearestNeighborRegression::predict(const cv::Mat_<double>& x, double& dist, int k, double eps) const {
+	if (index.empty() || k <= 0) {
+		dist = std::numeric_limits<double>::max();
+		return cv::Mat_<double>();
+	}
+
+	std::vector<int> indices;
+	std::vector<double> dists;
+	index.knnSearch(x, k, indices, dists, eps);
+
+	cv::Mat_<double> y = cv::Mat_<double>::zeros(1, Y.cols);
+	for (int i = 0; i < (int)indices.size(); ++i) {
+		y += Y.row(indices[i]);
+	}
+	y /= indices.size();
+
+	dist = sqrt(dists[0]);
+	return y;
+}
+
+/**
+ * 登録済みのデータから、Xの各行についてnearest neighborを探し、対応するyを返却する。
+ *
+ * @param X				データX (各行が各データ)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				yの予測値 (X.rows x Y.cols)
+ */
+cv::Mat_<double> NearestNeighborRegression::predictBatch(const cv::Mat_<double>& X, int numThreads) const {
+	cv::Mat_<double> dists;
+	return predictBatch(X, dists, 1, 0.0, numThreads);
+}
+
+/**
+ * 登録済みのデータから、Xの各行についてk近傍を探し、対応するyの平均を返却する。
+ * データが登録されていない、またはk <= 0の場合は、空の行列を返却する。
+ *
+ * @param X				データX (各行が各データ)
+ * @param dists [OUT]	各データのnearest neighborまでの距離 (X.rows x 1)
+ * @param k				近傍の数
+ * @param eps			近似の許容誤差
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				yの予測値 (X.rows x Y.cols)
+ */
+cv::Mat_<double> NearestNeighborRegression::predictBatch(const cv::Mat_<double>& X, cv::Mat_<double>& dists, int k, double eps, int numThreads) const {
+	if (index.empty() || k <= 0) {
+		dists = cv::Mat_<double>();
+		return cv::Mat_<double>();
+	}
+
+	cv::Mat_<int> indices;
+	cv::Mat_<double> neighborDists;
+	index.knnSearch(X, k, indices, neighborDists, eps, 0, numThreads);
+
+	cv::Mat_<double> Y2 = cv::Mat_<double>::zeros(X.rows, Y.cols);
+	dists = cv::Mat_<double>(X.rows, 1);
+	for (int r = 0; r < X.rows; ++r) {
+		int count = 0;
+		for (int i = 0; i < k; ++i) {
+			if (indices(r, i) < 0) break;
+			const double* y = Y[indices(r, i)];
+			for (int c = 0; c < Y.cols; ++c) {
+				Y2(r, c) += y[c];
+			}
+			count++;
+		}
+		for (int c = 0; c < Y.cols; ++c) {
+			Y2(r, c) /= count;
+		}
+		dists(r, 0) = sqrt(neighborDists(r, 0));
+	}
+
+	return Y2;
+}
+
+/**
+ * 登録済みのデータから、Xの各行についてnearest neighborを単精度で探し、対応するyを返却する。
+ *
+ * @param X				データX (各行が各データ)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				yの予測値 (X.rows x Y.cols)
+ */
+cv::Mat_<float> NearestNeighborRegression::predictBatchFloat(const cv::Mat_<float>& X, int numThreads) const {
+	if (floatIndex.empty()) return cv::Mat_<float>();
+
+	cv::Mat_<float> Y2(X.rows, floatY.cols);
+
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			float dist;
+			int nearest = floatIndex.nearest(X[r], dist);
+			memcpy(Y2[r], floatY[nearest], sizeof(float) * floatY.cols);
+		}
+	}, numThreads);
+
+	return Y2;
+}
+
+/**
+ * 単精度で推論した場合の誤差を、倍精度の予測値に対するRMSEで返却する。
+ * 距離がほぼ等しい近傍が複数ある場合、丸め誤差で別の近傍が選ばれることがあるので、検証用のデータで確認すること。
+ *
+ * @param X				検証用のデータX
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ * @return				RMSE (ml::rmse、averageColumns = false)
+ */
+double NearestNeighborRegression::floatRmse(const cv::Mat_<double>& X, int numThreads) const {
+	cv::Mat_<float> floatX;
+	X.convertTo(floatX, CV_32F);
+
+	cv::Mat_<double> floatPred;
+	predictBatchFloat(floatX, numThreads).convertTo(floatPred, CV_64F);
+
+	return ml::rmse(predictBatch(X, numThreads), floatPred, false);
+}
+
@@ -2,10 +2,23 @@
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
+#include "KDTree.h"
 
 class NearestNeighborRegression {
+private:
+	cv::Mat_<double> Y;
+	KDTree index;
+	cv::Mat_<float> floatY;		// 単精度で推論するためのYのコピー
+	KDTreeF floatIndex;			// 単精度で推論するためのk-d tree
+
 public:
 	NearestNeighborRegression();
+	NearestNeighborRegression(const cv::Mat_<double>& X, const cv::Mat_<double>& Y);
 	cv::Mat_<double> predict(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, const cv::Mat_<double>& x, double& dist);
+	cv::Mat_<double> predict(const cv::Mat_<double>& x, double& dist, int k = 1, double eps = 0.0) const;
+	cv::Mat_<double> predictBatch(const cv::Mat_<double>& X, int numThreads = 0) const;
+	cv::Mat_<double> predictBatch(const cv::Mat_<double>& X, cv::Mat_<double>& dists, int k = 1, double eps = 0.0, int numThreads = 0) const;
+	cv::Mat_<float> predictBatchFloat(const cv::Mat_<float>& X, int numThreads = 0) const;
+	double floatRmse(const cv::Mat_<double>& X, int numThreads = 0) const;
 };
 
@@ -0,0 +1,204 @@
+﻿#include "NormalEquation.h"
+#include "MLUtils.h"
+#include "ThreadPool.h"
+#include <mutex>
+
+using namespace std;
+
+NormalEquation::NormalEquation() : YtY(0.0), N(0) {
+}
+
+NormalEquation::NormalEquation(int D, int K) {
+	init(D, K);
+}
+
+/**
+ * 累積値を0に初期化する。
+ *
+ * @param D		Xの次元数 (バイアス列を含まない)
+ * @param K		Yの次元数
+ */
+void NormalEquation::init(int D, int K) {
+	XtX = cv::Mat_<double>::zeros(D + 1, D + 1);
+	XtY = cv::Mat_<double>::zeros(D + 1, K);
+	YtY = 0.0;
+	N = 0;
+}
+
+/**
+ * データX、Yを追加する。
+ * 行を区間に分けて、スレッドプールで並列に累積する。
+ *
+ * @param X				データX (N x D、バイアス列は含まない)
+ * @param Y				データY (N x K)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ */
+void NormalEquation::add(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, int numThreads) {
+	if (XtX.empty()) init(X.cols, Y.cols);
+
+	std::mutex mutex;
+	ThreadPool::instance().parallelFor(0, X.rows, [&](int begin, int end) {
+		NormalEquation partial(X.cols, Y.cols);
+		partial.accumulate(X.rowRange(begin, end), Y.rowRange(begin, end));
+
+		std::lock_guard<std::mutex> lock(mutex);
+		merge(partial);
+	}, numThreads);
+}
+
+/**
+ * 別のデータで累積した正規方程式を足し合わせる。
+ */
+void NormalEquation::merge(const NormalEquation& other) {
+	if (XtX.empty()) {
+		XtX = other.XtX.clone();
+		XtY = other.XtY.clone();
+		YtY = other.YtY;
+		N = other.N;
+		return;
+	}
+
+	XtX += other.XtX;
+	XtY += other.XtY;
+	YtY += other.YtY;
+	N += other.N;
+}
+
+/**
+ * 正規方程式を解いて、W ((D+1) x K、最終行がバイアス) を求める。
+ * DECOMP_CHOLESKYなら、対角スケーリングしたX'XをCholesky分解して解く。
+ * 分解できない場合や、条件数の推定値がmaxConditionを超える場合は、SVDで解く。
+ * DECOMP_QRなら、X'XをQR分解して解き、解けない場合はSVDで解く。
+ * それ以外なら、SVDで解く。
+ *
+ * @param W [OUT]			係数
+ * @param method			cv::DECOMP_CHOLESKY / cv::DECOMP_QR / cv::DECOMP_SVD
+ * @param maxCondition		Cholesky分解で許容する条件数
+ * @return					SVDに切り替えずに解けたらtrue
+ */
+bool NormalEquation::solve(cv::Mat_<double>& W, int method, double maxCondition) const {
+	if (method == cv::DECOMP_CHOLESKY) {
+		if (solveCholesky(W, maxCondition)) return true;
+	} else if (method == cv::DECOMP_QR) {
+		if (cv::solve(XtX, XtY, W, cv::DECOMP_QR)) return true;
+	}
+
+	cv::solve(XtX, XtY, W, cv::DECOMP_SVD);
+	return method == cv::DECOMP_SVD;
+}
+
+/**
+ * 累積したデータに対する、Wの残差を計算する。
+ * LinearRegression::trainと同じく、各データの誤差ベクトルの二乗ノルムの平均の平方根を返却する。
+ * ||XW - Y||^2 = Y'Y - 2tr(W'X'Y) + tr(W'X'XW) を使うので、データを再度走査する必要はない。
+ *
+ * @param W		係数 ((D+1) x K)
+ * @return		残差
+ */
+double NormalEquation::residual(const cv::Mat_<double>& W) const {
+	if (N == 0) return 0.0;
+
+	cv::Mat_<double> XtXW = XtX * W;
+	double rss = YtY - 2.0 * W.dot(XtY) + W.dot(XtXW);
+
+	return sqrt(std::max(0.0, rss) / N);
+}
+
+/**
+ * データX、Yを、このスレッドで累積する。
+ * X'Xは、バイアス列を除いた部分をmulTransposedで計算し、バイアス列の部分はXの列和とデータ数から埋める。
+ */
+void NormalEquation::accumulate(const cv::Mat_<double>& X, const cv::Mat_<double>& Y) {
+	int D = X.cols;
+
+	cv::Mat_<double> XtX0;
+	cv::mulTransposed(X, XtX0, true);
+	cv::Mat_<double> XtY0;
+	cv::gemm(X, Y, 1.0, cv::Mat(), 0.0, XtY0, cv::GEMM_1_T);
+
+	cv::Mat_<double> sumX, sumY;
+	cv::reduce(X, sumX, 0, CV_REDUCE_SUM);
+	cv::reduce(Y, sumY, 0, CV_REDUCE_SUM);
+
+	XtX0.copyTo(XtX(cv::Rect(0, 0, D, D)));
+	for (int c = 0; c < D; ++c) {
+		XtX(c, D) = sumX(0, c);
+		XtX(D, c) = sumX(0, c);
+	}
+	XtX(D, D) = X.rows;
+
+	XtY0.copyTo(XtY(cv::Rect(0, 0, XtY.cols, D)));
+	sumY.copyTo(XtY.row(D));
+
+	YtY = Y.dot(Y);
+	N = X.rows;
+}
+
+/**
+ * X'XをCholesky分解して、正規方程式を解く。
+ * 各変数のスケールの違いを除くため、対角要素が1になるようスケーリングしてから分解する。
+ * 条件数は、Cholesky因子の対角要素の最大値と最小値の比の二乗で推定する。
+ *
+ * @param W [OUT]			係数
+ * @param maxCondition		許容する条件数
+ * @return					分解できて、条件数がmaxCondition以下ならtrue
+ */
+bool NormalEquation::solveCholesky(cv::Mat_<double>& W, double maxCondition) const {
+	int n = XtX.rows;
+	int K = XtY.cols;
+
+	vector<double> scale(n);
+	for (int i = 0; i < n; ++i) {
+		if (XtX(i, i) <= 0) return false;
+		scale[i] = 1.0 / sqrt(XtX(i, i));
+	}
+
+	// L (下三角) にCholesky分解する
+	cv::Mat_<double> L = cv::Mat_<double>::zeros(n, n);
+	double min_diag = std::numeric_limits<double>::max();
+	double max_diag = 0.0;
+	for (int j = 0; j < n; ++j) {
+		double s = XtX(j, j) * scale[j] * scale[j];
+		for (int k = 0; k < j; ++k) {
+			s -= L(j, k) * L(j, k);
+		}
+		if (s <= 0) return false;
+		L(j, j) = sqrt(s);
+		min_diag = std::min(min_diag, L(j, j));
+		max_diag = std::max(max_diag, L(j, j));
+
+		for (int i = j + 1; i < n; ++i) {
+			double t = XtX(i, j) * scale[i] * scale[j];
+			for (int k = 0; k < j; ++k) {
+				t -= L(i, k) * L(j, k);
+			}
+			L(i, j) = t / L(j, j);
+		}
+	}
+
+	if (ml::sqr(max_diag / min_diag) > maxCondition) return false;
+
+	// L L' (W / scale) = scale * X'Y を、前進代入、後退代入で解く
+	W = cv::Mat_<double>(n, K);
+	for (int c = 0; c < K; ++c) {
+		for (int i = 0; i < n; ++i) {
+			double t = XtY(i, c) * scale[i];
+			for (int k = 0; k < i; ++k) {
+				t -= L(i, k) * W(k, c);
+			}
+			W(i, c) = t / L(i, i);
+		}
+		for (int i = n - 1; i >= 0; --i) {
+			double t = W(i, c);
+			for (int k = i + 1; k < n; ++k) {
+				t -= L(k, i) * W(k, c);
+			}
+			W(i, c) = t / L(i, i);
+		}
+		for (int i = 0; i < n; ++i) {
+			W(i, c) *= scale[i];
+		}
+	}
+
+	return true;
+}
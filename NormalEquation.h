@@ -0,0 +1,31 @@
+﻿#pragma once
+
+#include <opencv/cv.h>
+
+/**
+ * 線形回帰の正規方程式 (X'X)W = X'Y。
+ * データを何回かに分けて追加し、X'X、X'Y、Yの二乗和、データ数を累積する。
+ * Xの右端にはバイアス列 (全て1) があるものとして扱うので、addBiasしたXを渡す必要はない。
+ */
+class NormalEquation {
+public:
+	cv::Mat_<double> XtX;	// (D+1) x (D+1)
+	cv::Mat_<double> XtY;	// (D+1) x K
+	double YtY;				// Yの要素の二乗和
+	int N;					// データ数
+
+public:
+	NormalEquation();
+	NormalEquation(int D, int K);
+
+	void init(int D, int K);
+	void add(const cv::Mat_<double>& X, const cv::Mat_<double>& Y, int numThreads = 0);
+	void merge(const NormalEquation& other);
+	bool solve(cv::Mat_<double>& W, int method = cv::DECOMP_CHOLESKY, double maxCondition = 1e10) const;
+	double residual(const cv::Mat_<double>& W) const;
+
+private:
+	void accumulate(const cv::Mat_<double>& X, const cv::Mat_<double>& Y);
+	bool solveCholesky(cv::Mat_<double>& W, double maxCondition) const;
+};
+
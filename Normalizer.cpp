@@ -0,0 +1,259 @@
+﻿#include "Normalizer.h"
+#include "ModelFile.h"
+#include <string>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * 正規化の方法を指定して初期化する。
+ *
+ * @param method	STANDARDIZE (平均0、標準偏差1) / MIN_MAX (最小値0、最大値1)
+ */
+Normalizer::Normalizer(int method) : method(method) {
+	clear();
+}
+
+/**
+ * 累積した統計量を全て破棄する。
+ */
+void Normalizer::clear() {
+	moments.count = 0;
+	moments.mean.clear();
+	moments.m2.clear();
+	minimum.release();
+	maximum.release();
+	offset.release();
+	scale.release();
+}
+
+/**
+ * 累積した統計量を破棄してから、Xの統計量を計算する。
+ *
+ * @param X				データ (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ */
+void Normalizer::fit(const cv::Mat_<double>& X, int numThreads) {
+	clear();
+	partialFit(X, numThreads);
+}
+
+/**
+ * Xの統計量を、これまでの累積値に加える。
+ * データ全体をメモリに載せずに、チャンクごとに呼び出せる。
+ *
+ * @param X				データ (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ */
+void Normalizer::partialFit(const cv::Mat_<double>& X, int numThreads) {
+	if (X.rows == 0) return;
+
+	if (method == MIN_MAX) {
+		cv::Mat_<double> lo, hi;
+		ml::columnMinMax(X, lo, hi, numThreads);
+		mergeRange(lo, hi);
+		moments.count += X.rows;
+	} else {
+		ml::ColumnMoments chunk;
+		ml::columnMoments(X, chunk, numThreads);
+		ml::mergeMoments(moments, chunk);
+	}
+
+	update();
+}
+
+/**
+ * 別に累積した統計量を結合する。
+ * 正規化の方法、または列数が異なる場合は、何もせずにfalseを返却する。
+ *
+ * @param other		結合する正規化
+ * @return			結合できたらtrue
+ */
+bool Normalizer::merge(const Normalizer& other) {
+	if (other.method != method) return false;
+	if (other.count() == 0) return true;
+	if (!empty() && other.offset.cols != offset.cols) return false;
+
+	if (method == MIN_MAX) {
+		mergeRange(other.minimum, other.maximum);
+		moments.count += other.moments.count;
+	} else {
+		ml::mergeMoments(moments, other.moments);
+	}
+
+	update();
+	return true;
+}
+
+bool Normalizer::empty() const {
+	return offset.empty();
+}
+
+/**
+ * これまでに累積したデータ数を返却する。
+ */
+long long Normalizer::count() const {
+	return moments.count;
+}
+
+const cv::Mat_<double>& Normalizer::getOffset() const {
+	return offset;
+}
+
+const cv::Mat_<double>& Normalizer::getScale() const {
+	return scale;
+}
+
+/**
+ * 1行のデータを、その場で正規化する。
+ *
+ * @param x [IN/OUT]	データ (D次元)
+ */
+void Normalizer::apply(double* x) const {
+	const double* mu = offset[0];
+	const double* sigma = scale[0];
+	for (int c = 0; c < offset.cols; ++c) {
+		x[c] = (x[c] - mu[c]) / sigma[c];
+	}
+}
+
+/**
+ * Xの各行を、その場で正規化する。
+ *
+ * @param X [IN/OUT]	データ (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ */
+void Normalizer::apply(cv::Mat_<double>& X, int numThreads) const {
+	ml::normalize(X, offset, scale, numThreads);
+}
+
+/**
+ * 正規化した1行のデータを、その場で元のスケールに戻す。
+ *
+ * @param x [IN/OUT]	データ (D次元)
+ */
+void Normalizer::invert(double* x) const {
+	const double* mu = offset[0];
+	const double* sigma = scale[0];
+	for (int c = 0; c < offset.cols; ++c) {
+		x[c] = x[c] * sigma[c] + mu[c];
+	}
+}
+
+/**
+ * 正規化したXの各行を、その場で元のスケールに戻す。
+ *
+ * @param X [IN/OUT]	データ (N x D)
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ */
+void Normalizer::invert(cv::Mat_<double>& X, int numThreads) const {
+	ml::denormalize(X, offset, scale, numThreads);
+}
+
+/**
+ * 正規化の方法と累積値を、name.method、name.count、name.mean、name.m2 (STANDARDIZE)
+ * またはname.min、name.max (MIN_MAX) のセクションとして追加する。
+ * 累積値ごと保存するので、読み込んだ後もpartialFitやmergeを続けられる。
+ *
+ * @param file		モデルファイル
+ * @param name		セクション名の接頭辞 (24文字まで)
+ */
+void Normalizer::write(ModelFile& file, const char* name) const {
+	string prefix = string(name) + ".";
+	file.add((prefix + "method").c_str(), (double)method);
+	file.add((prefix + "count").c_str(), (double)moments.count);
+
+	if (method == MIN_MAX) {
+		file.add((prefix + "min").c_str(), minimum);
+		file.add((prefix + "max").c_str(), maximum);
+	} else {
+		int D = moments.mean.size();
+		cv::Mat_<double> mean(1, D), m2(1, D);
+		for (int c = 0; c < D; ++c) {
+			mean(0, c) = moments.mean[c];
+			m2(0, c) = moments.m2[c];
+		}
+		file.add((prefix + "mean").c_str(), mean);
+		file.add((prefix + "m2").c_str(), m2);
+	}
+}
+
+/**
+ * writeで追加したセクションから、正規化を読み込む。
+ *
+ * @param file		モデルファイル
+ * @param name		セクション名の接頭辞
+ * @return			セクションがない、またはサイズが合わなければfalse
+ */
+bool Normalizer::read(const ModelFile& file, const char* name) {
+	string prefix = string(name) + ".";
+	double m, n;
+	if (!file.get((prefix + "method").c_str(), m) || !file.get((prefix + "count").c_str(), n)) return false;
+
+	if ((int)m != STANDARDIZE && (int)m != MIN_MAX) return false;
+
+	clear();
+	method = (int)m;
+	moments.count = (long long)n;
+
+	if (method == MIN_MAX) {
+		cv::Mat_<double> lo, hi;
+		if (!file.get((prefix + "min").c_str(), lo) || !file.get((prefix + "max").c_str(), hi) || lo.rows != 1 || hi.rows != 1 || lo.cols != hi.cols) return false;
+		minimum = lo.clone();
+		maximum = hi.clone();
+	} else {
+		cv::Mat_<double> mean, m2;
+		if (!file.get((prefix + "mean").c_str(), mean) || !file.get((prefix + "m2").c_str(), m2) || mean.rows != 1 || m2.rows != 1 || mean.cols != m2.cols) return false;
+		moments.mean.assign(mean[0], mean[0] + mean.cols);
+		moments.m2.assign(m2[0], m2[0] + m2.cols);
+	}
+
+	update();
+	return true;
+}
+
+/**
+ * 列ごとの最小値、最大値を、これまでの累積値に結合する。
+ *
+ * @param lo		各列の最小値 (1 x D)
+ * @param hi		各列の最大値 (1 x D)
+ */
+void Normalizer::mergeRange(const cv::Mat_<double>& lo, const cv::Mat_<double>& hi) {
+	if (minimum.empty()) {
+		minimum = lo.clone();
+		maximum = hi.clone();
+		return;
+	}
+
+	for (int c = 0; c < minimum.cols; ++c) {
+		minimum(0, c) = std::min(minimum(0, c), lo(0, c));
+		maximum(0, c) = std::max(maximum(0, c), hi(0, c));
+	}
+}
+
+/**
+ * 累積値から、適用するオフセットとスケールを計算する。
+ * STANDARDIZEのスケールは不偏標準偏差 (ml::meanStdDevと同じ)。
+ * 値が一定の列はスケールが0になるので、0で割らないよう1とする。
+ */
+void Normalizer::update() {
+	if (method == MIN_MAX) {
+		if (minimum.empty()) return;
+		offset = minimum.clone();
+		scale = maximum - minimum;
+	} else {
+		int D = moments.mean.size();
+		if (D == 0) return;
+		offset.create(1, D);
+		scale.create(1, D);
+		for (int c = 0; c < D; ++c) {
+			offset(0, c) = moments.mean[c];
+			scale(0, c) = moments.count > 1 ? sqrt(moments.m2[c] / (moments.count - 1)) : 0.0;
+		}
+	}
+
+	for (int c = 0; c < scale.cols; ++c) {
+		if (scale(0, c) == 0.0) scale(0, c) = 1.0;
+	}
+}
+
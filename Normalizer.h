@@ -0,0 +1,51 @@
+﻿#pragma once
+
+#include <opencv/cv.h>
+#include "MLUtils.h"
+
+class ModelFile;
+
+/**
+ * データの正規化。
+ * 統計量はチャンクごとに累積でき (partialFit)、別々に累積したものを結合できる (merge) ので、
+ * シャードごとに並列に計算して1つにまとめられる。
+ * 一度求めたオフセットとスケールは、モデルと同じファイルに保存でき、
+ * 推論時には1行ずつ、またはまとめて、メモリを確保せずにその場で適用できる。
+ */
+class Normalizer {
+public:
+	enum { STANDARDIZE = 0, MIN_MAX };
+
+private:
+	int method;
+	ml::ColumnMoments moments;		// STANDARDIZEの累積値
+	cv::Mat_<double> minimum;		// MIN_MAXの累積値
+	cv::Mat_<double> maximum;
+	cv::Mat_<double> offset;		// 適用するオフセット (1 x D)
+	cv::Mat_<double> scale;			// 適用するスケール (1 x D)
+
+public:
+	Normalizer(int method = STANDARDIZE);
+
+	void clear();
+	void fit(const cv::Mat_<double>& X, int numThreads = 0);
+	void partialFit(const cv::Mat_<double>& X, int numThreads = 0);
+	bool merge(const Normalizer& other);
+	bool empty() const;
+	long long count() const;
+	const cv::Mat_<double>& getOffset() const;
+	const cv::Mat_<double>& getScale() const;
+
+	void apply(double* x) const;
+	void apply(cv::Mat_<double>& X, int numThreads = 0) const;
+	void invert(double* x) const;
+	void invert(cv::Mat_<double>& X, int numThreads = 0) const;
+
+	void write(ModelFile& file, const char* name = "normalizer") const;
+	bool read(const ModelFile& file, const char* name = "normalizer");
+
+private:
+	void mergeRange(const cv::Mat_<double>& lo, const cv::Mat_<double>& hi);
+	void update();
+};
+
@@ -0,0 +1,418 @@
+﻿#include "Random.h"
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <atomic>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RANDOM_SIMD_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// jump()、longJump()の多項式 (それぞれ2^128、2^192回のnext()に相当)
+const unsigned long long JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+const unsigned long long LONG_JUMP[] = { 0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL, 0x77710069854ee241ULL, 0x39109bb02acbe635ULL };
+
+// SIMDでまとめて生成するレーンの数と、SIMDを使う最小の要素数
+const int LANES = 4;
+const int SIMD_FILL_SIZE = 1024;
+
+const double TWO_PI = 6.283185307179586476925286766559;
+
+// スレッドごとのストリームのシード。seedLocalで世代を進め、各スレッドは次に使う時に作り直す
+std::mutex localMutex;
+unsigned long long localSeed = 1;
+std::atomic<int> localGeneration(0);
+int nextLocalStream = 0;
+
+struct LocalStream {
+	Random rng;
+	int generation;
+
+	LocalStream() : generation(-1) {}
+};
+
+thread_local LocalStream localStream;
+
+inline unsigned long long rotl(unsigned long long x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+inline unsigned long long splitmix64(unsigned long long& x) {
+	unsigned long long z = (x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * 64bitの乱数の上位52bit (floatは23bit) を仮数部とし、[1, 2)の値を作って1を引く。
+ */
+inline double bitsToDouble(unsigned long long x) {
+	unsigned long long bits = (x >> 12) | 0x3ff0000000000000ULL;
+	double d;
+	memcpy(&d, &bits, sizeof(d));
+	return d - 1.0;
+}
+
+inline float bitsToFloat(unsigned int x) {
+	unsigned int bits = (x >> 9) | 0x3f800000U;
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f - 1.0f;
+}
+
+#ifdef RANDOM_SIMD_X86
+
+/**
+ * LANES個の状態を並べて、xoshiro256**を4レーン同時に進める。
+ * s[i]は、各レーンの状態のi番目の要素。x * 5、x * 9はシフトと加算で計算する。
+ */
+__attribute__((target("avx2")))
+inline __m256i nextAvx2(__m256i* s) {
+	__m256i x = _mm256_add_epi64(_mm256_slli_epi64(s[1], 2), s[1]);
+	x = _mm256_or_si256(_mm256_slli_epi64(x, 7), _mm256_srli_epi64(x, 57));
+	__m256i result = _mm256_add_epi64(_mm256_slli_epi64(x, 3), x);
+
+	__m256i t = _mm256_slli_epi64(s[1], 17);
+	s[2] = _mm256_xor_si256(s[2], s[0]);
+	s[3] = _mm256_xor_si256(s[3], s[1]);
+	s[1] = _mm256_xor_si256(s[1], s[2]);
+	s[0] = _mm256_xor_si256(s[0], s[3]);
+	s[2] = _mm256_xor_si256(s[2], t);
+	s[3] = _mm256_or_si256(_mm256_slli_epi64(s[3], 45), _mm256_srli_epi64(s[3], 19));
+	return result;
+}
+
+/**
+ * lanes[k]の状態から、k, k + LANES, k + 2 LANES, ...番目の要素を生成する (countはLANESの倍数)。
+ * 64bitごとに、doubleなら1個、floatなら2個の値になる。
+ */
+__attribute__((target("avx2")))
+void fillAvx2(unsigned long long lanes[][4], double* dst, int count) {
+	__m256i s[4];
+	for (int i = 0; i < 4; ++i) {
+		s[i] = _mm256_setr_epi64x(lanes[0][i], lanes[1][i], lanes[2][i], lanes[3][i]);
+	}
+
+	const __m256i one = _mm256_set1_epi64x(0x3ff0000000000000LL);
+	const __m256d oneD = _mm256_set1_pd(1.0);
+	for (int i = 0; i < count; i += LANES) {
+		__m256i bits = _mm256_or_si256(_mm256_srli_epi64(nextAvx2(s), 12), one);
+		_mm256_storeu_pd(dst + i, _mm256_sub_pd(_mm256_castsi256_pd(bits), oneD));
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		unsigned long long v[4];
+		_mm256_storeu_si256((__m256i*)v, s[i]);
+		for (int k = 0; k < LANES; ++k) lanes[k][i] = v[k];
+	}
+}
+
+__attribute__((target("avx2")))
+void fillAvx2(unsigned long long lanes[][4], float* dst, int count) {
+	__m256i s[4];
+	for (int i = 0; i < 4; ++i) {
+		s[i] = _mm256_setr_epi64x(lanes[0][i], lanes[1][i], lanes[2][i], lanes[3][i]);
+	}
+
+	const __m256i one = _mm256_set1_epi32(0x3f800000);
+	const __m256 oneF = _mm256_set1_ps(1.0f);
+	for (int i = 0; i < count; i += LANES * 2) {
+		__m256i bits = _mm256_or_si256(_mm256_srli_epi32(nextAvx2(s), 9), one);
+		_mm256_storeu_ps(dst + i, _mm256_sub_ps(_mm256_castsi256_ps(bits), oneF));
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		unsigned long long v[4];
+		_mm256_storeu_si256((__m256i*)v, s[i]);
+		for (int k = 0; k < LANES; ++k) lanes[k][i] = v[k];
+	}
+}
+
+bool hasAvx2() {
+	static const bool supported = []() {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+	}();
+	return supported;
+}
+
+#endif
+
+/**
+ * [0, 1)の一様乱数の列を、Box-Muller法でその場で正規乱数の列に変換する (nは偶数)。
+ */
+template<typename T>
+void boxMuller(T* dst, int n, T mean, T stddev) {
+	for (int i = 0; i + 1 < n; i += 2) {
+		double r = sqrt(-2.0 * log(1.0 - (double)dst[i]));
+		double theta = TWO_PI * dst[i + 1];
+		dst[i] = (T)(mean + stddev * r * cos(theta));
+		dst[i + 1] = (T)(mean + stddev * r * sin(theta));
+	}
+}
+
+}
+
+/**
+ * シードを指定して初期化する。
+ *
+ * @param seed		シード
+ */
+Random::Random(unsigned long long seed) {
+	this->seed(seed);
+}
+
+/**
+ * シードから初期化し、jump()をstream回行う。
+ * 同じシードで番号の異なるストリームは重ならないので、チャンクごとに番号を割り当てれば、
+ * スレッド数や実行順によらず同じ結果を再現できる。
+ *
+ * @param seed		シード
+ * @param stream	ストリームの番号
+ */
+Random::Random(unsigned long long seed, int stream) {
+	this->seed(seed);
+	for (int i = 0; i < stream; ++i) {
+		jump();
+	}
+}
+
+void Random::seed(unsigned long long seed) {
+	for (int i = 0; i < 4; ++i) {
+		state[i] = splitmix64(seed);
+	}
+	hasSpare = false;
+	spare = 0.0;
+}
+
+/**
+ * 2^128回next()を呼んだのと同じ状態に進める。
+ */
+void Random::jump() {
+	applyJump(JUMP);
+}
+
+/**
+ * 2^192回next()を呼んだのと同じ状態に進める。
+ */
+void Random::longJump() {
+	applyJump(LONG_JUMP);
+}
+
+void Random::applyJump(const unsigned long long* polynomial) {
+	unsigned long long s[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 4; ++i) {
+		for (int b = 0; b < 64; ++b) {
+			if (polynomial[i] & (1ULL << b)) {
+				for (int k = 0; k < 4; ++k) s[k] ^= state[k];
+			}
+			next();
+		}
+	}
+	memcpy(state, s, sizeof(state));
+}
+
+/**
+ * 64bitの乱数を生成する (xoshiro256**)。
+ */
+unsigned long long Random::next() {
+	unsigned long long result = rotl(state[1] * 5, 7) * 9;
+	unsigned long long t = state[1] << 17;
+
+	state[2] ^= state[0];
+	state[3] ^= state[1];
+	state[1] ^= state[2];
+	state[0] ^= state[3];
+	state[2] ^= t;
+	state[3] = rotl(state[3], 45);
+
+	return result;
+}
+
+/**
+ * [0, 1)の一様乱数 (53bit精度) を生成する。
+ */
+double Random::uniform() {
+	return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * [a, b)の一様乱数を生成する。
+ */
+double Random::uniform(double a, double b) {
+	return a + (b - a) * uniform();
+}
+
+/**
+ * [0, 1)の一様乱数 (24bit精度) を生成する。doubleから変換すると1.0fに丸められる場合があるので、別に用意する。
+ */
+float Random::uniformFloat() {
+	return (next() >> 40) * (1.0f / 16777216.0f);
+}
+
+/**
+ * [0, n)の整数の一様乱数を生成する (Lemireの方法。偏りはない)。
+ */
+int Random::uniformInt(int n) {
+	if (n <= 1) return 0;
+
+	unsigned long long range = (unsigned long long)n;
+	unsigned long long x = next() >> 32;
+	unsigned long long m = x * range;
+	unsigned long long low = m & 0xffffffffULL;
+	if (low < range) {
+		unsigned long long threshold = (0x100000000ULL - range) % range;
+		while (low < threshold) {
+			x = next() >> 32;
+			m = x * range;
+			low = m & 0xffffffffULL;
+		}
+	}
+	return (int)(m >> 32);
+}
+
+/**
+ * 標準正規分布の乱数を生成する (Marsagliaのpolar法)。
+ * 2つ目の値はこのオブジェクトに保持し、次の呼び出しで返却する。
+ */
+double Random::normal() {
+	if (hasSpare) {
+		hasSpare = false;
+		return spare;
+	}
+
+	double x1, x2, w;
+	do {
+		x1 = 2.0 * uniform() - 1.0;
+		x2 = 2.0 * uniform() - 1.0;
+		w = x1 * x1 + x2 * x2;
+	} while (w >= 1.0 || w == 0.0);
+
+	w = sqrt(-2.0 * log(w) / w);
+	spare = x2 * w;
+	hasSpare = true;
+	return x1 * w;
+}
+
+double Random::normal(double mean, double stddev) {
+	return mean + stddev * normal();
+}
+
+/**
+ * dstをn個の[a, b)の一様乱数で埋める。
+ * nが大きく、AVX2に対応したCPUでは、この状態からlongJump()で作った4つのレーンを同時に進めて生成し、
+ * 終わったらこのオブジェクトの状態を1つ目のレーンの状態にする。結果は状態とnだけで決まる。
+ * この場合の精度は、doubleは52bit、floatは23bit。
+ *
+ * @param dst [OUT]		出力 (n個)
+ * @param n				個数
+ * @param a				最小値
+ * @param b				最大値 (この値は含まない)
+ */
+void Random::fillUniform(double* dst, int n, double a, double b) {
+	fillUniformBits(dst, n);
+	if (a != 0.0 || b != 1.0) {
+		for (int i = 0; i < n; ++i) {
+			dst[i] = a + (b - a) * dst[i];
+		}
+	}
+}
+
+void Random::fillUniform(float* dst, int n, float a, float b) {
+	fillUniformBits(dst, n);
+	if (a != 0.0f || b != 1.0f) {
+		for (int i = 0; i < n; ++i) {
+			dst[i] = a + (b - a) * dst[i];
+		}
+	}
+}
+
+/**
+ * dstをn個の正規乱数で埋める。
+ * 一様乱数をfillUniformでまとめて生成し、Box-Muller法でその場で変換する。
+ *
+ * @param dst [OUT]		出力 (n個)
+ * @param n				個数
+ * @param mean			平均
+ * @param stddev		標準偏差
+ */
+void Random::fillNormal(double* dst, int n, double mean, double stddev) {
+	int even = n & ~1;
+	fillUniformBits(dst, even);
+	boxMuller(dst, even, mean, stddev);
+	if (even < n) dst[even] = normal(mean, stddev);
+}
+
+void Random::fillNormal(float* dst, int n, float mean, float stddev) {
+	int even = n & ~1;
+	fillUniformBits(dst, even);
+	boxMuller(dst, even, mean, stddev);
+	if (even < n) dst[even] = (float)normal(mean, stddev);
+}
+
+/**
+ * dstをn個の[0, 1)の一様乱数で埋める。
+ */
+template<typename T>
+void Random::fillUniformBits(T* dst, int n) {
+	int i = 0;
+
+#ifdef RANDOM_SIMD_X86
+	if (n >= SIMD_FILL_SIZE && hasAvx2()) {
+		// 1回のnext()で、doubleは1個、floatは2個の値を生成する
+		const int step = LANES * (int)(sizeof(double) / sizeof(T));
+
+		unsigned long long lanes[LANES][4];
+		memcpy(lanes[0], state, sizeof(state));
+		for (int k = 1; k < LANES; ++k) {
+			longJump();
+			memcpy(lanes[k], state, sizeof(state));
+		}
+
+		i = n / step * step;
+		fillAvx2(lanes, dst, i);
+		memcpy(state, lanes[0], sizeof(state));
+	}
+#endif
+
+	for (; i < n; ++i) {
+		dst[i] = sizeof(T) == sizeof(float) ? (T)bitsToFloat((unsigned int)(next() >> 32)) : (T)bitsToDouble(next());
+	}
+}
+
+/**
+ * 呼び出したスレッドのストリームを返却する。
+ * スレッドごとに別のオブジェクトなので、ロックなしで使える。
+ * seedLocalを呼んだスレッドはストリーム0、それ以外のスレッドは、最初に使った順に1, 2, ...番目のストリームを使う。
+ */
+Random& Random::local() {
+	if (localStream.generation != localGeneration) {
+		lock_guard<std::mutex> lock(localMutex);
+		localStream.rng = Random(localSeed, nextLocalStream++);
+		localStream.generation = localGeneration;
+	}
+	return localStream.rng;
+}
+
+/**
+ * 全てのスレッドのストリームのシードを設定する。
+ * 呼び出したスレッドのストリームはすぐに作り直し、他のスレッドは次に使う時に作り直す。
+ *
+ * @param seed		シード
+ */
+void Random::seedLocal(unsigned long long seed) {
+	lock_guard<std::mutex> lock(localMutex);
+	localSeed = seed;
+	localGeneration++;
+	nextLocalStream = 1;
+
+	localStream.rng = Random(seed, 0);
+	localStream.generation = localGeneration;
+}
+
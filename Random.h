@@ -0,0 +1,45 @@
+﻿#pragma once
+
+/**
+ * 乱数生成器 (xoshiro256**)。
+ * 状態はオブジェクトごとに持つので、スレッドごと、ストリームごとに別のオブジェクトを使えば、
+ * ロックなしで並列に生成でき、スレッドの実行順によらず同じ系列を再現できる。
+ * シードはsplitmix64で256bitの状態に展開する。
+ * jump()で2^128個先に進めるので、同じシードからstream番目のjumpで作ったストリーム同士は重ならない。
+ */
+class Random {
+private:
+	unsigned long long state[4];
+	bool hasSpare;		// normal()で生成した2つ目の値を持っているか
+	double spare;
+
+public:
+	Random(unsigned long long seed = 1);
+	Random(unsigned long long seed, int stream);
+
+	void seed(unsigned long long seed);
+	void jump();
+	void longJump();
+
+	unsigned long long next();
+	double uniform();
+	double uniform(double a, double b);
+	float uniformFloat();
+	int uniformInt(int n);
+	double normal();
+	double normal(double mean, double stddev);
+
+	void fillUniform(double* dst, int n, double a = 0.0, double b = 1.0);
+	void fillUniform(float* dst, int n, float a = 0.0f, float b = 1.0f);
+	void fillNormal(double* dst, int n, double mean = 0.0, double stddev = 1.0);
+	void fillNormal(float* dst, int n, float mean = 0.0f, float stddev = 1.0f);
+
+	static Random& local();
+	static void seedLocal(unsigned long long seed);
+
+private:
+	void applyJump(const unsigned long long* polynomial);
+	template<typename T>
+	void fillUniformBits(T* dst, int n);
+};
+
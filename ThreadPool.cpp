@@ -0,0 +1,150 @@
+﻿#include "ThreadPool.h"
+#include <algorithm>
+#include <exception>
+
+using namespace std;
+
+/**
+ * スレッドプールを作成する。
+ *
+ * @param numThreads	ワーカースレッドの数 (0ならハードウェアのスレッド数)
+ */
+ThreadPool::ThreadPool(int numThreads) : stopping(false) {
+	if (numThreads <= 0) {
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	for (int i = 0; i < numThreads; ++i) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	for (int i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+}
+
+int ThreadPool::size() const {
+	return workers.size();
+}
+
+/**
+ * [begin, end)の範囲をnumThreads個の連続した区間に分割し、並列にfunc(区間の開始, 区間の終了)を実行する。
+ * 呼び出したスレッドも1つの区間を担当し、全ての区間が終わるまで戻らない。
+ * funcが例外を投げた場合、全ての区間が終わった後で、最初の例外を再送出する。
+ *
+ * @param begin			開始index
+ * @param end			終了index (この値は含まない)
+ * @param func			各区間で実行する関数
+ * @param numThreads	使用するスレッド数 (0ならプールのスレッド数)
+ */
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)>& func, int numThreads) {
+	int n = end - begin;
+	if (n <= 0) return;
+
+	int chunks = numThreads > 0 ? numThreads : size();
+	chunks = std::min(chunks, n);
+	if (chunks <= 1) {
+		func(begin, end);
+		return;
+	}
+
+	int remaining = chunks - 1;
+	std::mutex doneMutex;
+	std::condition_variable done;
+	std::exception_ptr error;
+
+	auto runChunk = [&](int i) {
+		int chunkBegin = begin + (long long)n * i / chunks;
+		int chunkEnd = begin + (long long)n * (i + 1) / chunks;
+		try {
+			func(chunkBegin, chunkEnd);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(doneMutex);
+			if (!error) error = std::current_exception();
+		}
+	};
+
+	for (int i = 1; i < chunks; ++i) {
+		enqueue([&, i]() {
+			runChunk(i);
+			std::lock_guard<std::mutex> lock(doneMutex);
+			if (--remaining == 0) done.notify_all();
+		});
+	}
+
+	runChunk(0);
+
+	// 残りの区間が終わるまで、キュー内のタスクを手伝う
+	// (remainingはdoneMutexの下で確認し、他スレッドがdoneを通知し終えてから戻る)
+	while (true) {
+		{
+			std::lock_guard<std::mutex> lock(doneMutex);
+			if (remaining == 0) break;
+		}
+		if (runPendingTask()) continue;
+
+		std::unique_lock<std::mutex> lock(doneMutex);
+		done.wait(lock, [&]() { return remaining == 0; });
+		break;
+	}
+
+	if (error) std::rethrow_exception(error);
+}
+
+/**
+ * プロセス全体で共有するスレッドプールを返却する。
+ * ワーカースレッドの数はハードウェアのスレッド数。
+ */
+ThreadPool& ThreadPool::instance() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::enqueue(const std::function<void()>& task) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push(task);
+	}
+	condition.notify_one();
+}
+
+/**
+ * キューにタスクがあれば1つ取り出して実行する。
+ *
+ * @return		タスクを実行したらtrue
+ */
+bool ThreadPool::runPendingTask() {
+	std::function<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (tasks.empty()) return false;
+		task = tasks.front();
+		tasks.pop();
+	}
+
+	task();
+	return true;
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty()) return;
+			task = tasks.front();
+			tasks.pop();
+		}
+
+		task();
+	}
+}
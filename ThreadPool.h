@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * スレッドプール。
+ * 起動時に作成したワーカースレッドでタスクを実行する。
+ * parallelForで待っているスレッドも、キュー内のタスクを実行するので、
+ * parallelForの中から更にparallelForを呼んでもデッドロックしない。
+ */
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()> > tasks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping;
+
+public:
+	ThreadPool(int numThreads = 0);
+	~ThreadPool();
+
+	int size() const;
+	void parallelFor(int begin, int end, const std::function<void(int, int)>& func, int numThreads = 0);
+
+	static ThreadPool& instance();
+
+private:
+	void enqueue(const std::function<void()>& task);
+	bool runPendingTask();
+	void workerLoop();
+};
+
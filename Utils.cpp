@@ -1,11 +1,17 @@
 ﻿#include "Utils.h"
-#include <random>
+#include "Random.h"
+#include <cmath>
+
+void initRand(int seed) {
+	Random::seedLocal(seed);
+}
 
 /**
- * Uniform乱数[0, 1)を生成する
+ * Uniform乱数[0, 1)を生成する。
+ * 呼び出したスレッドのストリーム (Random::local) を使うので、ロックせずに並列に呼び出せる。
  */
 float genRand() {
-	return rand() / (float(RAND_MAX) + 1);
+	return Random::local().uniformFloat();
 }
 
 /**
@@ -17,46 +23,14 @@ float genRand(float a, float b) {
 
 /**
  * Normal distributionを使用して乱数を生成する。
+ * polar法の2つ目の値は、スレッドごとのストリームが保持する。
  */
 float genRandNormal(float mean, float variance) {
-	/*
-	static std::default_random_engine generator;
-
-	std::normal_distribution<float> distribution(mean, sqrtf(variance));
-	return distribution(generator);
-	*/
-
-#if 1
-	float m = mean;
-	float s = sqrt(variance);
-
-	/* mean m, standard deviation s */
-	float x1, x2, w, y1;
-	static float y2;
-	static int use_last = 0;
-
-	if (use_last) {	/* use value from previous call */
-		y1 = y2;
-		use_last = 0;
-	} else {
-		do {
-			x1 = 2.0 * genRand(0.0f, 1.0f) - 1.0;
-			x2 = 2.0 * genRand(0.0f, 1.0f) - 1.0;
-			w = x1 * x1 + x2 * x2;
-		} while ( w >= 1.0 );
-
-		w = sqrt( (-2.0 * ::log( w ) ) / w );
-		y1 = x1 * w;
-		y2 = x2 * w;
-		use_last = 1;
-	}
-
-	return m + y1 * s;
-#endif
+	return (float)Random::local().normal(mean, sqrt(variance));
 }
 
 float genRandInt(float a, float b, int num) {
-	int r = genRand(0, num);
+	int r = Random::local().uniformInt(num);
 	return a + (b - a) / (float)(num - 1) * r;
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 
 // random
 void initRand(int seed);
@@ -14,11 +15,8 @@ template<typename T>
 int sampleFromCdf(const std::vector<T> &cdf) {
 	float rnd = genRand(0, cdf.back());
 
-	for (int i = 0; i < cdf.size(); ++i) {
-		if (rnd <= cdf[i]) return i;
-	}
-
-	return cdf.size() - 1;
+	int i = std::lower_bound(cdf.begin(), cdf.end(), rnd) - cdf.begin();
+	return std::min(i, (int)cdf.size() - 1);
 }
 
 template<typename T>
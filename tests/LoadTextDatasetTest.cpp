@@ -0,0 +1,42 @@
+﻿#include "../MLUtils.h"
+#include <cstdio>
+#include <iostream>
+
+/**
+ * 空行の後に、複数の区間にまたがるデータが続くテキストを読み込む。
+ * 空行より前の行だけが読み込まれ、後ろの区間が先頭の行を上書きしないことを確認する。
+ */
+int main() {
+	char filename[] = "loadTextDatasetBlankLine.txt";
+	const int headRows = 100;
+	const int tailRows = 200000;
+
+	FILE* fp = fopen(filename, "w");
+	if (fp == NULL) return 1;
+	for (int r = 0; r < headRows; ++r) {
+		fprintf(fp, "%d,%d,%d\n", r, r * 2, r * 3);
+	}
+	fprintf(fp, "\n");
+	for (int r = 0; r < tailRows; ++r) {
+		fprintf(fp, "-1,-1,-1\n");
+	}
+	fclose(fp);
+
+	cv::Mat_<double> mat;
+	bool ok = ml::loadDataset(filename, mat);
+	remove(filename);
+
+	if (!ok || mat.rows != headRows || mat.cols != 3) {
+		std::cerr << "unexpected size: " << mat.rows << " x " << mat.cols << std::endl;
+		return 1;
+	}
+	for (int r = 0; r < headRows; ++r) {
+		if (mat(r, 0) != r || mat(r, 1) != r * 2 || mat(r, 2) != r * 3) {
+			std::cerr << "row " << r << " was overwritten" << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << "OK" << std::endl;
+	return 0;
+}